@@ -85,7 +85,14 @@ void setup()
 
   notecard.begin();  // Initialize the Notecard
 
+  // The Notecard keeps its settings across our resets and brown-outs, so
+  // read them back first and only send the requests that would change something
+
   // Set up the Notecard for hub communication
+  J *hub = notecard.requestAndResponse(notecard.newRequest("hub.get"));
+  if (hub == NULL || strcmp(JGetString(hub, "product"), productUID) != 0 ||
+      strcmp(JGetString(hub, "mode"), "periodic") != 0 ||
+      JGetInt(hub, "inbound") != 60 * 12 || JGetInt(hub, "outbound") != 30)
   {  
     J *req = notecard.newRequest("hub.set");
     JAddStringToObject(req, "product", productUID);
@@ -96,8 +103,11 @@ void setup()
       JDelete(req);  // Delete the request if sending fails
     }
   }
+  NoteDeleteResponse(hub);
 
   // Enable DFU (Device Firmware Update) mode on the Notecard
+  J *aux = notecard.requestAndResponse(notecard.newRequest("card.aux"));
+  if (aux == NULL || strcmp(JGetString(aux, "mode"), "dfu") != 0)
   {
     J *req = notecard.newRequest("card.aux");
     JAddStringToObject(req, "mode", "dfu");  // Set auxiliary card mode to DFU
@@ -105,8 +115,12 @@ void setup()
       JDelete(req);  // Delete the request if sending fails
     }
   }
+  NoteDeleteResponse(aux);
 
   // Set up periodic location tracking (every 5 minutes)
+  J *location = notecard.requestAndResponse(notecard.newRequest("card.location.mode"));
+  if (location == NULL || strcmp(JGetString(location, "mode"), "periodic") != 0 ||
+      JGetInt(location, "seconds") != 60 * 5)
   {
     J *req = notecard.newRequest("card.location.mode");
     JAddStringToObject(req, "mode", "periodic");
@@ -115,6 +129,7 @@ void setup()
       JDelete(req);  // Delete the request if sending fails
     }
   }
+  NoteDeleteResponse(location);
 
 }
 
@@ -0,0 +1,217 @@
+// Microbenchmark of the sketch's compute kernels, run on Linux against the
+// fakes. Prints one row per kernel: wall-clock ns/op, and the note-c
+// allocations and bytes per op, counted by wrapping the NoteSetFn() hooks
+// notecard.begin() installs. Host timings only rank alternatives against
+// each other; the MCU is far slower, and its FPU and libc differ.
+//
+//   bench_kernels [--iterations N]
+#include "../mux_final_program.cpp"
+#include <chrono>
+#include <time.h>  // Only for the libc comparison kernel
+
+void Bench_Baseline();
+void Bench_PM_Aggregate();
+void Bench_Fixed_Round();
+void Bench_Float_Round();
+void Bench_Humidity_Correct();
+void Bench_Time_Format();
+void Bench_Time_Format_Libc();
+void Bench_Data_Note();
+void Bench_Decimator_Add();
+
+// Each entry is one operation; add a row next to an existing one to compare
+// an alternative implementation
+struct BenchmarkKernel {
+  const char *name;
+  void (*run)();
+};
+const BenchmarkKernel benchmarkKernels[] = {
+  { "baseline", Bench_Baseline },  // Loop and call overhead, subtracted from the others
+  { "pm_aggregate", Bench_PM_Aggregate },  // Read_PM25AQI(): unpack, accumulate, scale one frame
+  { "fixed_round", Bench_Fixed_Round },  // Read_AHTX0(): average to the fixed-point record
+  { "float_round", Bench_Float_Round },  // Previous round(x * 100) / 100 rounding
+  { "humidity_correct", Bench_Humidity_Correct },  // PM_Humidity_Correct() table lookup
+  { "time_format", Bench_Time_Format },  // Time_Format() civil-from-days into the dashboard strings
+  { "time_format_libc", Bench_Time_Format_Libc },  // Previous localtime() and strftime() version
+  { "json_data_note", Bench_Data_Note },  // Data_Note() keyframe built and freed
+  { "decimator_add", Bench_Decimator_Add },  // Acquire_For(): one INA260 value into the CIC decimator
+};
+unsigned long benchAllocs = 0;
+unsigned long benchAllocBytes = 0;
+mallocFn benchSavedMalloc;  // Hooks from notecard.begin(), wrapped during the run and put back after
+freeFn benchSavedFree;
+delayMsFn benchSavedDelay;
+getMsFn benchSavedMillis;
+volatile float benchInput = 23.456;  // Volatile so the kernels are not folded away
+volatile long benchSink;
+volatile float benchFloatSink;
+SampleRecord benchRecord;
+Decimator benchDecimator;
+
+void *Bench_Malloc(size_t size)
+{
+  benchAllocs++;
+  benchAllocBytes += size;
+  return benchSavedMalloc(size);
+}
+
+void Bench_Free(void *p)
+{
+  benchSavedFree(p);
+}
+
+void Bench_Delay(uint32_t ms)
+{
+  benchSavedDelay(ms);
+}
+
+uint32_t Bench_Millis()
+{
+  return benchSavedMillis();
+}
+
+void Benchmark_Run(unsigned long iterations)
+{
+  NoteGetFn(&benchSavedMalloc, &benchSavedFree, &benchSavedDelay, &benchSavedMillis);
+  NoteSetFn(Bench_Malloc, Bench_Free, Bench_Delay, Bench_Millis);
+
+  // A representative record for the JSON kernel
+  benchRecord.time = 1730000000UL;
+  benchRecord.lat = 4481000;
+  benchRecord.lon = -9223000;
+  for (uint8_t k = 0; k < MAX_SENSOR_INSTANCES; k++) {
+    benchRecord.temperature[k] = 2345;
+    benchRecord.humidity[k] = 4120;
+    benchRecord.current[k] = 182;
+    benchRecord.voltage[k] = 5012;
+    benchRecord.power[k] = 912;
+    for (uint8_t f = 0; f < PM_FIELDS; f++) {
+      benchRecord.pm[k][f] = 100 + f;
+    }
+  }
+
+  printf("kernel\tns_op\tallocs_op\tbytes_op\n");
+  double baselineNs = 0;
+  for (const BenchmarkKernel &kernel : benchmarkKernels) {
+    unsigned long allocs = benchAllocs;
+    unsigned long allocBytes = benchAllocBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long n = 0; n < iterations; n++) {
+      kernel.run();
+    }
+    double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (&kernel == &benchmarkKernels[0]) {
+      baselineNs = elapsedNs;
+    } else {
+      elapsedNs = (elapsedNs > baselineNs) ? elapsedNs - baselineNs : 0;
+    }
+    printf("%s\t%.1f\t%.2f\t%.1f\n", kernel.name, elapsedNs / iterations, (double)(benchAllocs - allocs) / iterations,
+           (double)(benchAllocBytes - allocBytes) / iterations);
+  }
+
+  // Every Notecard request after this goes through the original hooks again
+  NoteSetFn(benchSavedMalloc, benchSavedFree, benchSavedDelay, benchSavedMillis);
+}
+
+void Bench_Baseline()
+{
+  benchSink = benchInput;
+}
+
+void Bench_PM_Aggregate()
+{
+  PM25_AQI_Data data = {};
+  data.pm25_env = (uint16_t)benchInput;
+  float fields[PM_FIELDS];
+  float sums[PM_FIELDS] = {0};
+  PM25AQI_Fields(&data, fields);
+  for (uint8_t f = 0; f < PM_FIELDS; f++) {
+    sums[f] += fields[f];
+    benchRecord.pm[1][f] = Fixed(sums[f] / 10, pmFieldScale[f], 0, UINT16_MAX);
+  }
+}
+
+void Bench_Fixed_Round()
+{
+  benchSink = Fixed(benchInput / 10, 100, INT16_MIN, INT16_MAX);
+}
+
+void Bench_Float_Round()
+{
+  benchFloatSink = round(benchInput / 10 * 100) / 100;
+}
+
+void Bench_Humidity_Correct()
+{
+  benchFloatSink = PM_Humidity_Correct(benchInput, benchInput * 3);
+}
+
+void Bench_Time_Format()
+{
+  TimeFields t;
+  Time_Format(benchRecord.time + (long)benchInput, &t);
+  benchSink = t.ss[1];
+}
+
+void Bench_Time_Format_Libc()
+{
+  TimeFields t;
+  time_t rawtime = benchRecord.time + (long)benchInput;
+  struct tm ts = *localtime(&rawtime);
+  strftime(t.yyyy, sizeof(t.yyyy), "%Y", &ts);
+  strftime(t.mM, sizeof(t.mM), "%m", &ts);
+  strftime(t.dd, sizeof(t.dd), "%d", &ts);
+  strftime(t.hh, sizeof(t.hh), "%H", &ts);
+  strftime(t.ss, sizeof(t.ss), "%S", &ts);
+  strftime(t.mm, sizeof(t.mm), "%M", &ts);
+  benchSink = t.ss[1];
+}
+
+void Bench_Data_Note()
+{
+  J *req = Data_Note(&benchRecord, true);
+  if (req != NULL) {
+    JDelete(req);
+  }
+}
+
+void Bench_Decimator_Add()
+{
+  // outputs is 16 bits; start over well before it wraps
+  if (benchDecimator.outputs > 60000) {
+    Decimator_Reset(&benchDecimator);
+  }
+  Decimator_Add(&benchDecimator, (int32_t)benchInput);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long iterations = 100000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = strtoul(argv[++i], NULL, 10);
+    }
+  }
+
+  // The sketch's own allocator hooks, as setup() would leave them
+  notecard.begin(Serial1);
+  mallocFn mallocHook;
+  freeFn freeHook;
+  delayMsFn delayHook;
+  getMsFn millisHook;
+  NoteGetFn(&mallocHook, &freeHook, &delayHook, &millisHook);
+
+  Benchmark_Run(iterations);
+
+  // The counting wrappers must not outlive the run
+  mallocFn mallocAfter;
+  freeFn freeAfter;
+  delayMsFn delayAfter;
+  getMsFn millisAfter;
+  NoteGetFn(&mallocAfter, &freeAfter, &delayAfter, &millisAfter);
+  if (mallocAfter != mallocHook || freeAfter != freeHook || delayAfter != delayHook || millisAfter != millisHook) {
+    fprintf(stderr, "Benchmark_Run() left its hooks installed\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+// Decodes PROFILE health.qo note bodies into a table, one row per phase,
+// with the range each reported percentile truly lies in.
+//
+//   decode_health [HEALTH.jsonl]
+//
+// Reads one note body per line, from standard input if no file is given.
+// Times are in milliseconds; see health.h for the bucket resolution.
+// Built like the simulator, since the fakes that supply note-c's JSON
+// parser link against a sketch.
+#define PROFILE 1
+#include "../mux_final_program.cpp"
+#include "health.h"
+#include <iostream>
+#include <fstream>
+
+static std::string Range(const PhaseHealth &phase, int percent)
+{
+  double lowMs, highMs;
+  char text[48];
+  if (!Health_Bound(phase, percent, &lowMs, &highMs)) {
+    return "-";
+  }
+  snprintf(text, sizeof(text), "%.3f-%.3f", lowMs, highMs);
+  return text;
+}
+
+int main(int argc, char **argv)
+{
+  std::ifstream file;
+  if (argc > 1) {
+    file.open(argv[1]);
+    if (!file) {
+      fprintf(stderr, "usage: decode_health [HEALTH.jsonl]\n");
+      return 2;
+    }
+  }
+  std::istream &in = (argc > 1) ? file : std::cin;
+
+  printf("note\tcycles\tphase\tn\tp50\tp50_range\tp90\tp90_range\tp99\tp99_range\tmax\n");
+  std::string line;
+  int note = 0;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    Health health;
+    if (!Health_Decode(line, &health)) {
+      fprintf(stderr, "note %d: not a JSON body\n", note);
+      return 1;
+    }
+    for (const PhaseHealth &phase : health.phases) {
+      unsigned long n = 0;
+      for (unsigned long count : phase.hist) {
+        n += count;
+      }
+      printf("%d\t%lu\t%s\t%lu\t%.3f\t%s\t%.3f\t%s\t%.3f\t%s\t%.3f\n", note, health.cycles, phase.name.c_str(), n,
+             phase.p50Ms, Range(phase, 50).c_str(), phase.p90Ms, Range(phase, 90).c_str(), phase.p99Ms,
+             Range(phase, 99).c_str(), phase.maxMs);
+    }
+    note++;
+  }
+  return 0;
+}
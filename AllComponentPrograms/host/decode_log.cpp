@@ -0,0 +1,31 @@
+// Decodes a DEBUG_DEFERRED build's serial output back into text.
+//
+//   decode_log [CAPTURE.bin]
+//
+// Reads the raw bytes captured from the serial port, from standard input
+// if no file is given, and prints what a plain DEBUG build would have.
+// Literals defined before the capture started show as [format N].
+#define DEBUG 1
+#define DEBUG_DEFERRED 1
+#include "../mux_final_program.cpp"
+#include "log_decode.h"
+
+int main(int argc, char **argv)
+{
+  FILE *f = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+  if (f == NULL) {
+    fprintf(stderr, "usage: decode_log [CAPTURE.bin]\n");
+    return 2;
+  }
+  LogDecoder decoder;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    std::string text = decoder.Add(std::string(buffer, n));
+    fwrite(text.data(), 1, text.size(), stdout);
+  }
+  if (decoder.badFrames > 0) {
+    fprintf(stderr, "%lu frames did not decode\n", decoder.badFrames);
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+// Host-side decoder for PROFILE health.qo notes.
+//
+// The sketch counts each phase duration in log2 bucket b, which holds
+// [2^b, 2^(b+1)) microseconds, and reports a percentile as the upper edge
+// of its bucket, capped at the phase maximum. A reported p50/p90/p99 can
+// therefore be up to twice the true value. The note also carries the
+// nonzero span of every histogram ("lo" and "hist"), from which
+// Health_Bound() gives the interval the true percentile lies in.
+#pragma once
+#include <string>
+#include <vector>
+#include <Notecard.h>
+
+struct PhaseHealth {
+  std::string name;
+  double p50Ms, p90Ms, p99Ms, maxMs;  // As reported
+  int lo = -1;  // Bucket of hist[0], -1 when the phase recorded nothing
+  std::vector<unsigned long> hist;
+};
+
+struct Health {
+  unsigned long cycles = 0;
+  std::vector<PhaseHealth> phases;
+};
+
+// The range the true percentile lies in, in milliseconds; false when the
+// phase has no histogram
+inline bool Health_Bound(const PhaseHealth &phase, int percent, double *lowMs, double *highMs)
+{
+  unsigned long total = 0;
+  for (unsigned long count : phase.hist) {
+    total += count;
+  }
+  if (phase.lo < 0 || total == 0) {
+    return false;
+  }
+  unsigned long target = (total * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (size_t i = 0; i < phase.hist.size(); i++) {
+    seen += phase.hist[i];
+    if (seen >= target) {
+      int b = phase.lo + (int)i;
+      double edgeMs = ((2UL << b) - 1) / 1000.0;
+      *lowMs = (b == 0) ? 0 : (1UL << b) / 1000.0;
+      *highMs = (edgeMs < phase.maxMs) ? edgeMs : phase.maxMs;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every phase in a health.qo body; the Notecard request counters are skipped
+inline bool Health_Decode(const std::string &body, Health *health)
+{
+  J *object = JParse(body.c_str());
+  if (object == NULL) {
+    return false;
+  }
+  health->cycles = (unsigned long)JGetInt(object, "cycles");
+  health->phases.clear();
+  for (J *item = object->child; item != NULL; item = item->next) {
+    if (item->type != JObject || !JIsPresent(item, "p50")) {
+      continue;
+    }
+    PhaseHealth phase;
+    phase.name = item->string;
+    phase.p50Ms = JGetNumber(item, "p50");
+    phase.p90Ms = JGetNumber(item, "p90");
+    phase.p99Ms = JGetNumber(item, "p99");
+    phase.maxMs = JGetNumber(item, "max");
+    J *hist = JGetObjectItem(item, "hist");
+    if (hist != NULL && JIsPresent(item, "lo")) {
+      phase.lo = (int)JGetInt(item, "lo");
+      for (int i = 0; i < JGetArraySize(hist); i++) {
+        phase.hist.push_back((unsigned long)JGetArrayItem(hist, i)->valuenumber);
+      }
+    }
+    health->phases.push_back(phase);
+  }
+  JDelete(object);
+  return true;
+}
@@ -0,0 +1,25 @@
+// Host stand-in for Adafruit_AHTX0. getEvent() takes as long as the real
+// trigger-and-wait measurement does.
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+
+#define AHTX0_I2CADDR_DEFAULT 0x38
+
+typedef struct {
+  int32_t version;
+  int32_t sensor_id;
+  int32_t type;
+  int32_t reserved0;
+  int32_t timestamp;
+  union {
+    float temperature;
+    float relative_humidity;
+  };
+} sensors_event_t;
+
+class Adafruit_AHTX0 {
+public:
+  bool begin(TwoWire *wire = &Wire, int32_t sensorId = 0, uint8_t i2cAddress = AHTX0_I2CADDR_DEFAULT);
+  bool getEvent(sensors_event_t *humidity, sensors_event_t *temp);
+};
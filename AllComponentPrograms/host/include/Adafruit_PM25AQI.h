@@ -0,0 +1,22 @@
+// Host stand-in for Adafruit_PM25AQI over I2C. read() returns the frame the
+// PMSA003I on the current mux port last produced.
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+
+#define PMSA003I_I2CADDR_DEFAULT 0x12
+
+typedef struct PMSAQIdata {
+  uint16_t framelen;
+  uint16_t pm10_standard, pm25_standard, pm100_standard;
+  uint16_t pm10_env, pm25_env, pm100_env;
+  uint16_t particles_03um, particles_05um, particles_10um, particles_25um, particles_50um, particles_100um;
+  uint16_t unused;
+  uint16_t checksum;
+} PM25_AQI_Data;
+
+class Adafruit_PM25AQI {
+public:
+  bool begin_I2C(TwoWire *theWire = &Wire);
+  bool read(PM25_AQI_Data *data);
+};
@@ -0,0 +1,115 @@
+// Host stand-in for the Arduino core. millis(), micros() and delay() run on
+// the virtual clock in sim_arduino.cpp; pins and interrupts are routed to
+// the sensor and Notecard fakes; Serial output is captured for the tests.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void detachInterrupt(int interrupt);
+
+long random(long maxValue);
+long random(long minValue, long maxValue);
+void randomSeed(unsigned long seed);
+
+// Formatting follows the Arduino Print class: integers in the given base,
+// floating point with a fixed number of decimals (2 by default)
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  size_t write(uint8_t c) { return write(&c, 1); }
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC) { return print((long long)n, base); }
+  size_t print(unsigned long n, int base = DEC) { return print((unsigned long long)n, base); }
+  size_t print(long long n, int base = DEC)
+  {
+    if (base == DEC) {
+      char buf[24];
+      snprintf(buf, sizeof(buf), "%lld", n);
+      return print(buf);
+    }
+    return print((unsigned long long)n, base);
+  }
+  size_t print(unsigned long long n, int base = DEC)
+  {
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%llX" : "%llu", n);
+    return print(buf);
+  }
+  size_t print(double n, int digits = 2)
+  {
+    char buf[48];
+    if (isnan(n)) {
+      return print("nan");
+    }
+    if (isinf(n)) {
+      return print("inf");
+    }
+    if (n > 4294967040.0 || n < -4294967040.0) {
+      return print("ovf");
+    }
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+  }
+
+  size_t println() { return print("\r\n"); }
+  template <typename T>
+  size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T>
+  size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+  int availableForWrite() { return 64; }
+  void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+// Serial writes into simSerialOut (and stdout when simWorld.echoSerial is set)
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  operator bool() { return true; }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
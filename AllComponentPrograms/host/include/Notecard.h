@@ -0,0 +1,84 @@
+// Host stand-in for note-arduino and the parts of note-c the sketch uses.
+// The J* functions are a small JSON tree allocated through the NoteSetFn()
+// hooks, as in note-c; requests go to the scripted Notecard in
+// sim_notecard.cpp instead of a serial port.
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+
+#define JInvalid 0
+#define JFalse 1
+#define JTrue 2
+#define JNULL 3
+#define JNumber 4
+#define JString 5
+#define JArray 6
+#define JObject 7
+
+typedef struct J {
+  struct J *next, *prev;
+  struct J *child;  // Items of an array or object
+  int type;
+  char *valuestring;
+  long long valueint;
+  double valuenumber;
+  char *string;  // Key when the item is in an object
+} J;
+typedef long long JINTEGER;
+typedef double JNUMBER;
+
+J *JCreateObject(void);
+J *JCreateArray(void);
+J *JCreateNumber(JNUMBER number);
+J *JCreateString(const char *string);
+J *JCreateBool(bool value);
+void JDelete(J *item);
+void JFree(void *p);
+void JAddItemToObject(J *object, const char *name, J *item);
+void JAddItemToArray(J *array, J *item);
+J *JAddStringToObject(J *object, const char *name, const char *string);
+J *JAddNumberToObject(J *object, const char *name, JNUMBER number);
+J *JAddIntToObject(J *object, const char *name, JINTEGER number);
+J *JAddBoolToObject(J *object, const char *name, bool value);
+J *JAddObjectToObject(J *object, const char *name);
+J *JAddArrayToObject(J *object, const char *name);
+J *JGetObjectItem(const J *object, const char *name);
+J *JGetObject(J *object, const char *name);
+JINTEGER JGetInt(J *object, const char *name);
+JNUMBER JGetNumber(J *object, const char *name);
+bool JGetBool(J *object, const char *name);
+char *JGetString(J *object, const char *name);
+bool JIsPresent(J *object, const char *name);
+bool JIsNullString(J *object, const char *name);
+int JGetArraySize(J *array);
+J *JGetArrayItem(J *array, int index);
+char *JPrintUnformatted(const J *item);
+char *JConvertToJSONString(const J *item);
+J *JParse(const char *text);
+
+void NoteDeleteResponse(J *rsp);
+bool NoteResponseError(J *rsp);
+
+const char *NoteBinaryStoreReset(void);
+const char *NoteBinaryStoreTransmit(uint8_t *buffer, uint32_t dataLen, uint32_t bufferLen, uint32_t offset);
+uint32_t NoteBinaryCodecMaxEncodedLength(uint32_t unencodedLength);
+
+typedef void *(*mallocFn)(size_t size);
+typedef void (*freeFn)(void *p);
+typedef void (*delayMsFn)(uint32_t ms);
+typedef uint32_t (*getMsFn)(void);
+void NoteSetFn(mallocFn mallocHook, freeFn freeHook, delayMsFn delayHook, getMsFn millisHook);
+void NoteGetFn(mallocFn *mallocHook, freeFn *freeHook, delayMsFn *delayHook, getMsFn *millisHook);
+
+class Notecard {
+public:
+  void begin(HardwareSerial &serial, uint32_t speed = 9600);
+  void begin(uint32_t i2cAddress = 0x17, uint32_t i2cMax = 0, TwoWire &wire = Wire);
+  void setDebugOutputStream(Stream &debugStream);
+  J *newRequest(const char *request);
+  J *newCommand(const char *request);
+  bool sendRequest(J *req);
+  J *requestAndResponse(J *req);
+  void deleteResponse(J *rsp);
+  bool responseError(J *rsp);
+};
@@ -0,0 +1,22 @@
+// Host stand-in for the SparkFun Qwiic mux library. Port changes are I2C
+// writes to the TCA9548A and decide which fake devices the bus reaches.
+#pragma once
+#include <Arduino.h>
+#include <Wire.h>
+
+#define QWIIC_MUX_DEFAULT_ADDRESS 0x70
+
+class QWIICMUX {
+public:
+  bool begin(uint8_t deviceAddress = QWIIC_MUX_DEFAULT_ADDRESS, TwoWire &wirePort = Wire);
+  bool isConnected();
+  bool setPort(uint8_t portNumber);
+  uint8_t getPort();
+  bool enablePort(uint8_t portNumber);
+  bool disablePort(uint8_t portNumber);
+  bool setPortState(uint8_t portBits);
+  uint8_t getPortState();
+
+private:
+  uint8_t address = QWIIC_MUX_DEFAULT_ADDRESS;
+};
@@ -0,0 +1,28 @@
+// Host stand-in for the Arduino Wire library. Transfers reach the fake
+// device at the address on the mux port currently selected and take the
+// time their bytes need at the configured bus clock.
+#pragma once
+#include <Arduino.h>
+
+class TwoWire : public Stream {
+public:
+  void begin();
+  void setClock(uint32_t hz);
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t value);
+  size_t write(const uint8_t *buffer, size_t size) override;
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t address, size_t quantity, bool sendStop = true);
+  int available() override;
+  int read() override;
+
+private:
+  uint8_t txAddress = 0;
+  uint8_t txBuffer[32];
+  uint8_t txLength = 0;
+  uint8_t rxBuffer[32];
+  uint8_t rxLength = 0;
+  uint8_t rxIndex = 0;
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,142 @@
+// Host-side decoder for the DEBUG_DEFERRED binary log. Turns the records
+// debugFlush() sends back into the text a plain DEBUG build prints, with
+// numbers formatted the way Serial.print() formats them. Included after
+// ../mux_final_program.cpp, built with DEBUG_DEFERRED, for the record types.
+#pragma once
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+struct LogDecoder {
+  std::map<unsigned, std::string> formats;  // Format ID -> literal, from LOG_FORMAT records
+  std::string frame;  // Encoded bytes of the frame still arriving
+  unsigned long badFrames = 0;  // Frames that did not decode, and were skipped
+
+  // Text for the bytes received so far; a frame cut off at the end is kept
+  // for the next call
+  std::string Add(const std::string &bytes)
+  {
+    std::string text;
+    for (char c : bytes) {
+      if (c != 0) {
+        frame += c;
+        continue;
+      }
+      std::string record;
+      if (Unframe(frame, &record) && !record.empty()) {
+        Expand(record, &text);
+      } else {
+        badFrames++;
+      }
+      frame.clear();
+    }
+    return text;
+  }
+
+  static bool Unframe(const std::string &encoded, std::string *record)
+  {
+    // Undo the COBS encoding of one frame, its zero byte already removed
+    size_t i = 0;
+    while (i < encoded.size()) {
+      uint8_t code = encoded[i];
+      if (code == 0 || i + code > encoded.size()) {
+        return false;
+      }
+      record->append(encoded, i + 1, code - 1);
+      i += code;
+      if (code < 0xFF && i < encoded.size()) {
+        *record += '\0';
+      }
+    }
+    return true;
+  }
+
+  static uint64_t Little_Endian(const std::string &bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = bytes.size(); i-- > 0;) {
+      value = (value << 8) | (uint8_t)bytes[i];
+    }
+    return value;
+  }
+
+  static void Print_Double(double n, std::string *text)
+  {
+    // Serial.print(double) with its default two decimals
+    char buf[48];
+    if (isnan(n)) {
+      *text += "nan";
+    } else if (isinf(n)) {
+      *text += "inf";
+    } else if (n > 4294967040.0 || n < -4294967040.0) {
+      *text += "ovf";
+    } else {
+      snprintf(buf, sizeof(buf), "%.2f", n);
+      *text += buf;
+    }
+  }
+
+  void Expand(const std::string &record, std::string *text)
+  {
+    uint8_t type = record[0] & ~LOG_NEWLINE;
+    std::string payload = record.substr(1);
+    char buf[48];
+    switch (type) {
+    case LOG_LITERAL: {
+      unsigned id = (unsigned)Little_Endian(payload.substr(0, 2));
+      auto format = formats.find(id);
+      if (format != formats.end()) {
+        *text += format->second;
+      } else {
+        snprintf(buf, sizeof(buf), "[format %u]", id);  // Defined before the decoder joined
+        *text += buf;
+      }
+      break;
+    }
+    case LOG_FORMAT:
+      formats[(unsigned)Little_Endian(payload.substr(0, 2))] = payload.substr(2);
+      return;
+    case LOG_TEXT:
+      *text += payload;
+      break;
+    case LOG_LONG:
+    case LOG_ULONG: {
+      // As wide as the MCU's long
+      uint64_t value = Little_Endian(payload);
+      if (type == LOG_LONG && payload.size() < 8 && (value >> (8 * payload.size() - 1))) {
+        value |= ~0ULL << (8 * payload.size());  // Sign-extend
+      }
+      if (type == LOG_LONG) {
+        snprintf(buf, sizeof(buf), "%lld", (long long)value);
+      } else {
+        snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+      }
+      *text += buf;
+      break;
+    }
+    case LOG_DOUBLE:
+      if (payload.size() == sizeof(double)) {
+        double value;
+        memcpy(&value, payload.data(), sizeof(value));
+        Print_Double(value, text);
+      } else if (payload.size() == sizeof(float)) {
+        float value;  // A 4-byte double
+        memcpy(&value, payload.data(), sizeof(value));
+        Print_Double(value, text);
+      }
+      break;
+    case LOG_DROPPED:
+      snprintf(buf, sizeof(buf), "[debug log dropped %u entries]", (unsigned)Little_Endian(payload.substr(0, 2)));
+      *text += buf;
+      break;
+    default:
+      badFrames++;
+      return;
+    }
+    if (record[0] & LOG_NEWLINE) {
+      *text += "\r\n";
+    }
+  }
+};
@@ -0,0 +1,97 @@
+// Host-side reconstructor for SPARSE_PAYLOADS data notes. Feed it the note
+// bodies in order; it merges each sparse note into the last full record
+// and hands back complete records, the way a Notehub route would before
+// passing them to a dashboard that expects every field.
+//
+// Records are flattened to name -> text: instance arrays become
+// "ahtx0[3].temperature" by mux port, numbers are printed with %.10g.
+#pragma once
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <Notecard.h>
+
+typedef std::map<std::string, std::string> FlatRecord;
+
+inline void Record_Flatten(const J *object, const std::string &prefix, FlatRecord *record)
+{
+  for (const J *item = object->child; item != NULL; item = item->next) {
+    std::string name = prefix + item->string;
+    char text[32];
+    switch (item->type) {
+    case JNumber:
+      snprintf(text, sizeof(text), "%.10g", item->valuenumber);
+      (*record)[name] = text;
+      break;
+    case JString:
+      (*record)[name] = item->valuestring;
+      break;
+    case JTrue:
+    case JFalse:
+      (*record)[name] = (item->type == JTrue) ? "true" : "false";
+      break;
+    case JArray:
+      for (const J *entry = item->child; entry != NULL; entry = entry->next) {
+        J *port = JGetObjectItem(entry, "port");
+        if (entry->type == JObject && port != NULL) {
+          Record_Flatten(entry, name + "[" + std::to_string((long)port->valuenumber) + "].", record);
+        }
+      }
+      break;
+    case JObject:
+      Record_Flatten(item, name + ".", record);
+      break;
+    }
+  }
+}
+
+inline FlatRecord Record_From_Json(const std::string &body)
+{
+  FlatRecord record;
+  J *object = JParse(body.c_str());
+  if (object != NULL) {
+    Record_Flatten(object, "", &record);
+    JDelete(object);
+  }
+  record.erase("seq");
+  record.erase("key");
+  return record;
+}
+
+struct SparseReconstructor {
+  FlatRecord last;  // Every field as of the last note merged
+  bool valid = false;  // False until a keyframe, and again after a lost note
+  long lastSeq = -1;
+  unsigned long lost = 0;  // Notes missing from the sequence
+
+  // True with the complete record when the note can be rebuilt; a sparse
+  // note after a gap cannot, and everything waits for the next keyframe
+  bool Add(const std::string &body, FlatRecord *record)
+  {
+    J *object = JParse(body.c_str());
+    if (object == NULL) {
+      return false;
+    }
+    long seq = JIsPresent(object, "seq") ? (long)JGetInt(object, "seq") : -1;
+    bool key = JGetBool(object, "key");
+    JDelete(object);
+
+    if (lastSeq >= 0 && seq != lastSeq + 1) {
+      lost += (seq > lastSeq) ? seq - lastSeq - 1 : 1;
+      valid = false;
+    }
+    lastSeq = seq;
+    if (key) {
+      last.clear();
+      valid = true;
+    }
+    if (!valid) {
+      return false;
+    }
+    for (const auto &field : Record_From_Json(body)) {
+      last[field.first] = field.second;
+    }
+    *record = last;
+    return true;
+  }
+};
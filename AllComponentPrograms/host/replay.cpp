@@ -0,0 +1,102 @@
+// Replays a recorded trace through the sketch and prints how many data
+// notes and bytes a day it sends, so deadband settings can be compared on
+// real data before they are pushed to the fleet.
+//
+//   replay TRACE.csv [--env name=value]... [--header]
+//
+// TRACE.csv has one reading per line, linearly interpolated in between:
+//   seconds,current_ma,voltage_mv,temperature_c,humidity_rh,pm25
+// with seconds counted from the start of the trace; lines starting with #
+// are skipped. Each --env sets a Notecard environment variable before
+// boot, for example --env max_silence_s=3600 --env deadband_pm_mass=30.
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+
+struct TracePoint {
+  double s;
+  double value[5];  // current, voltage, temperature, humidity, pm25
+};
+static std::vector<TracePoint> trace;
+
+static double Trace_At(int column, double sinceStartS)
+{
+  // Linear between points, held at either end
+  if (sinceStartS <= trace.front().s) {
+    return trace.front().value[column];
+  }
+  for (size_t i = 1; i < trace.size(); i++) {
+    if (sinceStartS <= trace[i].s) {
+      const TracePoint &a = trace[i - 1], &b = trace[i];
+      return a.value[column] + (b.value[column] - a.value[column]) * (sinceStartS - a.s) / (b.s - a.s);
+    }
+  }
+  return trace.back().value[column];
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--header") == 0) {
+      printf("env\thours\tcycles\tnotes\tnotes_day\tnote_bytes_day\tcard_bytes_day\n");
+      return 0;
+    } else if (strcmp(argv[i], "--env") == 0 && i + 1 < argc) {
+      std::string setting = argv[++i];
+      size_t eq = setting.find('=');
+      if (eq == std::string::npos) {
+        fprintf(stderr, "--env needs name=value\n");
+        return 2;
+      }
+      Sim_Env_Set(setting.substr(0, eq).c_str(), setting.substr(eq + 1).c_str(), false);
+    } else {
+      path = argv[i];
+    }
+  }
+  FILE *f = path ? fopen(path, "r") : NULL;
+  if (f == NULL) {
+    fprintf(stderr, "usage: replay TRACE.csv [--env name=value]... [--header]\n");
+    return 2;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    TracePoint p;
+    if (line[0] != '#' && sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf", &p.s, &p.value[0], &p.value[1], &p.value[2],
+                                 &p.value[3], &p.value[4]) == 6) {
+      trace.push_back(p);
+    }
+  }
+  fclose(f);
+  if (trace.size() < 2) {
+    fprintf(stderr, "%s: need at least two readings\n", path);
+    return 2;
+  }
+
+  double startS = Sim_True_S();
+  simWorld.currentMa = [startS](int, double t) { return Trace_At(0, t - startS); };
+  simWorld.voltageMv = [startS](int, double t) { return Trace_At(1, t - startS); };
+  simWorld.temperatureC = [startS](int, double t) { return Trace_At(2, t - startS); };
+  simWorld.humidityRh = [startS](int, double t) { return Trace_At(3, t - startS); };
+  simWorld.pm25 = [startS](int, double t) { return Trace_At(4, t - startS); };
+  Sim_Run(startS + trace.back().s);
+
+  double days = (Sim_True_S() - startS) / 86400;
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  double noteBytes = 0;
+  for (const SimNote *note : notes) {
+    noteBytes += note->body.size();
+  }
+  double cardBytes = 0;
+  for (const SimRequest &request : simRequests) {
+    cardBytes += request.txBytes + request.rxBytes;
+  }
+  std::string env;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--env") == 0) {
+      env += (env.empty() ? "" : ",") + std::string(argv[++i]);
+    }
+  }
+  printf("%s\t%.1f\t%zu\t%zu\t%.1f\t%.0f\t%.0f\n", env.empty() ? "(defaults)" : env.c_str(), days * 24,
+         Sim_Cycle_Rows().size(), notes.size(), notes.size() / days, noteBytes / days, cardBytes / days);
+  return 0;
+}
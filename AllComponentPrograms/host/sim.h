@@ -0,0 +1,98 @@
+// Control and inspection API of the host simulation. A test or the cycle
+// simulator sets up simWorld, runs the sketch with Sim_Run() and then looks
+// at what reached the Notecard and the serial port.
+//
+// Time is virtual. The local clock behind millis() and micros() advances
+// when the sketch waits (delay(), a busy loop polling millis()) and by the
+// time each I2C transfer and Notecard transaction takes, so a simulated day
+// runs in a second or two. Host unsigned long is 64 bits, so millis()
+// never wraps here; the wraparound paths are not exercised.
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <Notecard.h>
+
+#define SIM_PM25AQI_SET_PIN 5
+#define SIM_INA260_ALERT_PIN 6
+#define SIM_NOTECARD_ATTN_PIN 9
+#define SIM_MUX_PORTS 8
+
+struct SimWorld {
+  // Clock
+  double driftPpm = 0;  // Local clock error, positive when millis() runs fast
+  uint32_t epochStart = 1760000000;  // UTC seconds at local time zero
+
+  // Notecard
+  bool notecardOnline = true;  // False: every request times out
+  bool notecardTimeKnown = true;  // False: card.time has no time until a sync completes
+  double notecardTimeoutS = 10;  // Wait before note-c gives up on a request
+  double syncS = 30;  // Length of a hub.sync
+  double gpsFixS = 45;  // Time to a fix after continuous mode is switched on
+  double lat = 46.8181, lon = -92.0846;
+  std::string deviceUID = "dev:864475044203262";  // hub.get "device"
+
+  // Sensors: bit n set = one of that device on mux port n
+  bool muxPresent = true;
+  uint8_t ina260Ports = 1 << 0;
+  uint8_t ahtx0Ports = 1 << 1;
+  uint8_t pm25aqiPorts = 1 << 2;
+
+  // Readings by mux port and true time (UTC seconds)
+  std::function<double(int port, double t)> currentMa = [](int, double) { return 182.0; };
+  std::function<double(int port, double t)> voltageMv = [](int, double) { return 5012.5; };
+  std::function<double(int port, double t)> temperatureC = [](int, double) { return 23.45; };
+  std::function<double(int port, double t)> humidityRh = [](int, double) { return 41.2; };
+  std::function<double(int port, double t)> pm25 = [](int, double) { return 12.0; };  // ug/m3, other fields scale from it
+
+  // Output and hooks
+  bool echoSerial = false;  // Copy sketch serial output to stdout
+  std::function<void()> onActivity;  // Called before every I2C transfer and Notecard request
+};
+extern SimWorld simWorld;
+
+// A note the Notecard accepted
+struct SimNote {
+  std::string file;
+  double trueS;
+  std::string body;  // JSON, "{}" without one
+  std::vector<uint8_t> binary;  // Binary buffer attached with "binary":true
+};
+
+// A request the Notecard saw, including the binary ones note-c makes itself
+struct SimRequest {
+  std::string name;
+  double trueS;
+  size_t txBytes, rxBytes;  // On the wire, newline included
+  bool answered;
+};
+
+extern std::string simSerialOut;  // Everything the sketch printed to Serial
+extern std::vector<SimNote> simNotes;
+extern std::vector<SimRequest> simRequests;
+extern unsigned long simI2cFastPmTransfers;  // Transfers above 100 kHz on a port with a PMSA003I
+extern unsigned long simI2cTransactions;  // Bus transactions; a repeated start continues the one before
+extern unsigned long simI2cBytes;  // Data bytes in either direction, address bytes not counted
+
+// Clock
+uint64_t Sim_Local_Us();
+double Sim_True_S();  // Notecard time, fractional
+void Sim_Advance_Us(uint64_t us);  // Let time pass, firing any device events that fall due
+void Sim_At_Us(uint64_t localUs, std::function<void()> event);  // Schedule an event on the local clock
+
+// Notecard
+void Sim_Env_Set(const char *name, const char *value, bool staged = true);  // Staged values arrive with the next sync
+void Sim_Command_Queue(const char *json, bool staged = true);  // Note body for commands.qi
+size_t Sim_Requests(const char *name);  // Requests of one type so far
+std::vector<const SimNote *> Sim_Notes(const char *file);
+bool Sim_Syncing();
+
+// Sensors
+double Sim_Fan_On_S();  // PMSA003I fan-on time so far
+bool Sim_Fan_On();
+
+// Runs setup() on the first call, then loop() until the Notecard time
+// reaches untilS. loop() is never interrupted, so the last cycle may end
+// a little after untilS.
+void Sim_Run(double untilS);
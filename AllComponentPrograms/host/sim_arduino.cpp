@@ -0,0 +1,202 @@
+// Virtual clock, pins, interrupts and Serial for the host build
+#include <map>
+#include "sim_internal.h"
+
+#define SPIN_TICK_MAX_US 20000  // Longest step a busy loop advances the clock per millis() call
+#define PIN_COUNT 64
+
+SimWorld simWorld;
+std::string simSerialOut;
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+void setup();
+void loop();
+
+static uint64_t localUs = 0;
+static uint64_t spinTickUs = 1;
+static bool inIsr = false;
+static std::multimap<uint64_t, std::function<void()>> events;
+
+static uint8_t pinLevel[PIN_COUNT];
+static uint8_t pinModeSet[PIN_COUNT];
+static void (*pinIsr[PIN_COUNT])();
+static int pinIsrMode[PIN_COUNT];
+static uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+uint64_t Sim_Local_Us()
+{
+  return localUs;
+}
+
+double Sim_True_At(uint64_t us)
+{
+  return simWorld.epochStart + us / 1e6 / (1 + simWorld.driftPpm * 1e-6);
+}
+
+double Sim_True_S()
+{
+  return Sim_True_At(localUs);
+}
+
+void Sim_At_Us(uint64_t us, std::function<void()> event)
+{
+  events.emplace(us, std::move(event));
+}
+
+void Sim_Advance_Us(uint64_t us)
+{
+  // Step to each event in turn so it sees its own time, then to the target
+  uint64_t target = localUs + us;
+  while (!events.empty() && events.begin()->first <= target) {
+    auto it = events.begin();
+    if (it->first > localUs) {
+      localUs = it->first;
+    }
+    std::function<void()> event = std::move(it->second);
+    events.erase(it);
+    event();
+  }
+  if (target > localUs) {
+    localUs = target;
+  }
+}
+
+void Sim_Activity()
+{
+  spinTickUs = 1;
+  if (simWorld.onActivity) {
+    simWorld.onActivity();
+  }
+}
+
+static void Spin()
+{
+  // A loop polling the clock is burning time; each call moves the clock on
+  // by a step that grows while nothing else happens, so a 15-minute wait
+  // costs tens of thousands of calls rather than millions
+  if (inIsr) {
+    return;
+  }
+  Sim_Advance_Us(spinTickUs);
+  if (spinTickUs < SPIN_TICK_MAX_US) {
+    spinTickUs *= 2;
+  }
+}
+
+unsigned long millis()
+{
+  Spin();
+  return localUs / 1000;
+}
+
+unsigned long micros()
+{
+  Spin();
+  return localUs;
+}
+
+void delay(unsigned long ms)
+{
+  spinTickUs = 1;
+  Sim_Advance_Us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  Sim_Advance_Us(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  pinModeSet[pin] = mode;
+  if (mode == INPUT_PULLUP && pin != SIM_INA260_ALERT_PIN) {
+    pinLevel[pin] = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  pinLevel[pin] = value ? HIGH : LOW;
+  Sim_Set_Pin_Written(pin, pinLevel[pin]);
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pinLevel[pin];
+}
+
+void Sim_Line_Set(uint8_t pin, int level)
+{
+  int previous = pinLevel[pin];
+  pinLevel[pin] = level;
+  if (pinIsr[pin] == NULL || previous == level) {
+    return;
+  }
+  int mode = pinIsrMode[pin];
+  if (mode == CHANGE || (mode == FALLING && level == LOW) || (mode == RISING && level == HIGH)) {
+    // Handlers run at the instant of the edge; micros() stands still inside
+    inIsr = true;
+    pinIsr[pin]();
+    inIsr = false;
+  }
+}
+
+int digitalPinToInterrupt(int pin)
+{
+  return pin;
+}
+
+void attachInterrupt(int interrupt, void (*isr)(), int mode)
+{
+  pinIsr[interrupt] = isr;
+  pinIsrMode[interrupt] = mode;
+}
+
+void detachInterrupt(int interrupt)
+{
+  pinIsr[interrupt] = NULL;
+}
+
+long random(long maxValue)
+{
+  // xorshift64, seeded the same every run so runs repeat exactly
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 7;
+  randomState ^= randomState << 17;
+  return (maxValue > 0) ? (long)(randomState % (uint64_t)maxValue) : 0;
+}
+
+long random(long minValue, long maxValue)
+{
+  return (maxValue > minValue) ? minValue + random(maxValue - minValue) : minValue;
+}
+
+void randomSeed(unsigned long seed)
+{
+  randomState = seed ? seed : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (this == &Serial) {
+    simSerialOut.append((const char *)buffer, size);
+    if (simWorld.echoSerial) {
+      fwrite(buffer, 1, size, stdout);
+    }
+  }
+  return size;
+}
+
+void Sim_Run(double untilS)
+{
+  static bool started = false;
+  if (!started) {
+    pinLevel[SIM_INA260_ALERT_PIN] = HIGH;  // Pulled up, open-drain outputs released
+    started = true;
+    setup();
+  }
+  while (Sim_True_S() < untilS) {
+    loop();
+  }
+}
@@ -0,0 +1,9 @@
+// Hooks between the fakes; tests use sim.h instead
+#pragma once
+#include "sim.h"
+
+void Sim_Activity();  // A device transfer starts: reset the spin tick and call simWorld.onActivity
+void Sim_Line_Set(uint8_t pin, int level);  // A device drives an input pin, firing a matching interrupt
+void Sim_Set_Pin_Written(uint8_t pin, int level);  // The sketch drove an output pin
+double Sim_True_At(uint64_t localUs);  // Notecard time at a point on the local clock
+void Sim_Notecard_Debug(const char *text);  // Echo to the stream given to setDebugOutputStream()
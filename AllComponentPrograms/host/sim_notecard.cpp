@@ -0,0 +1,870 @@
+// note-c JSON functions and a scripted Notecard. Each request takes the
+// time its JSON needs on the serial line at the rate given to begin(),
+// both ways, plus the Notecard's own processing time.
+#include <deque>
+#include <map>
+#include "sim_internal.h"
+
+#define NOTECARD_PROCESS_US 8000  // Turnaround of a simple request
+#define NOTECARD_NOTE_ADD_US 30000  // note.add writes flash
+#define NOTECARD_BINARY_PUT_US 40000  // card.binary.put decodes and checks the MD5
+#define GPS_FIX_PERIOD_S 60  // Fix updates in continuous mode after the first
+
+std::vector<SimNote> simNotes;
+std::vector<SimRequest> simRequests;
+
+static mallocFn hookMalloc = NULL;
+static freeFn hookFree = NULL;
+static delayMsFn hookDelay = NULL;
+static getMsFn hookMillis = NULL;
+static Stream *debugStream = NULL;
+static uint32_t uartBaud = 9600;
+
+// Notecard state
+static std::string hubProduct, hubMode;
+static bool syncing = false;
+static double lastSyncEndS = -1;  // When the last sync finished, -1 = never
+static std::map<std::string, std::string> env, envStaged;
+static uint32_t envModifiedS = 0;
+static std::deque<std::string> commands, commandsStaged;
+static bool attnArmed = false;
+static std::string locationMode = "off";
+static uint64_t fixAtUs = 0;  // Next fix in continuous mode, 0 = not searching
+static bool fixValid = false;
+static uint32_t fixTime = 0;
+static std::vector<uint8_t> binaryStore;
+
+// JSON
+
+static void *J_Malloc(size_t size)
+{
+  return hookMalloc ? hookMalloc(size) : malloc(size);
+}
+
+static void J_Free(void *p)
+{
+  if (p == NULL) {
+    return;
+  }
+  if (hookFree) {
+    hookFree(p);
+  } else {
+    free(p);
+  }
+}
+
+static char *J_Strdup(const char *s)
+{
+  size_t len = strlen(s) + 1;
+  char *copy = (char *)J_Malloc(len);
+  if (copy) {
+    memcpy(copy, s, len);
+  }
+  return copy;
+}
+
+static J *J_New(int type)
+{
+  J *item = (J *)J_Malloc(sizeof(J));
+  if (item) {
+    memset(item, 0, sizeof(J));
+    item->type = type;
+  }
+  return item;
+}
+
+J *JCreateObject(void)
+{
+  return J_New(JObject);
+}
+
+J *JCreateArray(void)
+{
+  return J_New(JArray);
+}
+
+J *JCreateNumber(JNUMBER number)
+{
+  J *item = J_New(JNumber);
+  if (item) {
+    item->valuenumber = number;
+    item->valueint = (number >= 9.2e18) ? INT64_MAX : (number <= -9.2e18) ? INT64_MIN : (JINTEGER)number;
+  }
+  return item;
+}
+
+J *JCreateString(const char *string)
+{
+  J *item = J_New(JString);
+  if (item) {
+    item->valuestring = J_Strdup(string ? string : "");
+  }
+  return item;
+}
+
+J *JCreateBool(bool value)
+{
+  return J_New(value ? JTrue : JFalse);
+}
+
+void JDelete(J *item)
+{
+  while (item != NULL) {
+    J *next = item->next;
+    JDelete(item->child);
+    J_Free(item->valuestring);
+    J_Free(item->string);
+    J_Free(item);
+    item = next;
+  }
+}
+
+void JFree(void *p)
+{
+  J_Free(p);
+}
+
+void JAddItemToArray(J *array, J *item)
+{
+  if (array == NULL || item == NULL) {
+    return;
+  }
+  if (array->child == NULL) {
+    array->child = item;
+    return;
+  }
+  J *last = array->child;
+  while (last->next) {
+    last = last->next;
+  }
+  last->next = item;
+  item->prev = last;
+}
+
+void JAddItemToObject(J *object, const char *name, J *item)
+{
+  if (object == NULL || item == NULL) {
+    JDelete(item);
+    return;
+  }
+  item->string = J_Strdup(name);
+  JAddItemToArray(object, item);
+}
+
+static J *J_Add(J *object, const char *name, J *item)
+{
+  if (object == NULL) {
+    JDelete(item);
+    return NULL;
+  }
+  JAddItemToObject(object, name, item);
+  return item;
+}
+
+J *JAddStringToObject(J *object, const char *name, const char *string)
+{
+  return J_Add(object, name, JCreateString(string));
+}
+
+J *JAddNumberToObject(J *object, const char *name, JNUMBER number)
+{
+  return J_Add(object, name, JCreateNumber(number));
+}
+
+J *JAddIntToObject(J *object, const char *name, JINTEGER number)
+{
+  J *item = J_Add(object, name, JCreateNumber((JNUMBER)number));
+  if (item) {
+    item->valueint = number;
+  }
+  return item;
+}
+
+J *JAddBoolToObject(J *object, const char *name, bool value)
+{
+  return J_Add(object, name, JCreateBool(value));
+}
+
+J *JAddObjectToObject(J *object, const char *name)
+{
+  return J_Add(object, name, JCreateObject());
+}
+
+J *JAddArrayToObject(J *object, const char *name)
+{
+  return J_Add(object, name, JCreateArray());
+}
+
+J *JGetObjectItem(const J *object, const char *name)
+{
+  if (object == NULL || name == NULL) {
+    return NULL;
+  }
+  for (J *item = object->child; item != NULL; item = item->next) {
+    if (item->string != NULL && strcmp(item->string, name) == 0) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+J *JGetObject(J *object, const char *name)
+{
+  J *item = JGetObjectItem(object, name);
+  return (item != NULL && item->type == JObject) ? item : NULL;
+}
+
+JINTEGER JGetInt(J *object, const char *name)
+{
+  J *item = JGetObjectItem(object, name);
+  if (item == NULL) {
+    return 0;
+  }
+  if (item->type == JNumber) {
+    return item->valueint;
+  }
+  if (item->type == JString) {
+    return strtoll(item->valuestring, NULL, 10);
+  }
+  return 0;
+}
+
+JNUMBER JGetNumber(J *object, const char *name)
+{
+  J *item = JGetObjectItem(object, name);
+  if (item == NULL) {
+    return 0;
+  }
+  if (item->type == JNumber) {
+    return item->valuenumber;
+  }
+  if (item->type == JString) {
+    return strtod(item->valuestring, NULL);
+  }
+  return 0;
+}
+
+bool JGetBool(J *object, const char *name)
+{
+  J *item = JGetObjectItem(object, name);
+  return item != NULL && item->type == JTrue;
+}
+
+char *JGetString(J *object, const char *name)
+{
+  // Absent or not a string reads as "", as in note-c
+  static char empty[] = "";
+  J *item = JGetObjectItem(object, name);
+  return (item != NULL && item->type == JString) ? item->valuestring : empty;
+}
+
+bool JIsPresent(J *object, const char *name)
+{
+  return JGetObjectItem(object, name) != NULL;
+}
+
+bool JIsNullString(J *object, const char *name)
+{
+  J *item = JGetObjectItem(object, name);
+  return item == NULL || (item->type == JString && item->valuestring[0] == '\0');
+}
+
+int JGetArraySize(J *array)
+{
+  int n = 0;
+  for (J *item = array ? array->child : NULL; item != NULL; item = item->next) {
+    n++;
+  }
+  return n;
+}
+
+J *JGetArrayItem(J *array, int index)
+{
+  J *item = array ? array->child : NULL;
+  while (item != NULL && index-- > 0) {
+    item = item->next;
+  }
+  return item;
+}
+
+static void Print_String(std::string &out, const char *s)
+{
+  out += '"';
+  for (; *s; s++) {
+    unsigned char c = *s;
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char esc[8];
+          snprintf(esc, sizeof(esc), "\\u%04x", c);
+          out += esc;
+        } else {
+          out += (char)c;
+        }
+    }
+  }
+  out += '"';
+}
+
+static void Print_Item(std::string &out, const J *item)
+{
+  // Integral numbers print as integers; others with the fewest digits
+  // that read back exactly
+  char number[32];
+  switch (item->type) {
+    case JFalse: out += "false"; break;
+    case JTrue: out += "true"; break;
+    case JNULL: out += "null"; break;
+    case JNumber:
+      if (item->valuenumber == (double)item->valueint && fabs(item->valuenumber) < 1e15) {
+        snprintf(number, sizeof(number), "%lld", item->valueint);
+      } else {
+        snprintf(number, sizeof(number), "%.15g", item->valuenumber);
+        if (strtod(number, NULL) != item->valuenumber) {
+          snprintf(number, sizeof(number), "%.17g", item->valuenumber);
+        }
+      }
+      out += number;
+      break;
+    case JString: Print_String(out, item->valuestring); break;
+    case JArray:
+    case JObject:
+      out += (item->type == JArray) ? '[' : '{';
+      for (const J *child = item->child; child != NULL; child = child->next) {
+        if (child != item->child) {
+          out += ',';
+        }
+        if (item->type == JObject) {
+          Print_String(out, child->string ? child->string : "");
+          out += ':';
+        }
+        Print_Item(out, child);
+      }
+      out += (item->type == JArray) ? ']' : '}';
+      break;
+  }
+}
+
+char *JPrintUnformatted(const J *item)
+{
+  if (item == NULL) {
+    return NULL;
+  }
+  std::string out;
+  Print_Item(out, item);
+  return J_Strdup(out.c_str());
+}
+
+char *JConvertToJSONString(const J *item)
+{
+  return JPrintUnformatted(item);
+}
+
+static J *Parse_Value(const char **p);
+
+static void Parse_Space(const char **p)
+{
+  while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') {
+    (*p)++;
+  }
+}
+
+static bool Parse_String(const char **p, std::string &out)
+{
+  if (**p != '"') {
+    return false;
+  }
+  (*p)++;
+  while (**p && **p != '"') {
+    char c = *(*p)++;
+    if (c == '\\') {
+      c = *(*p)++;
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u': c = (char)strtol(std::string(*p, 4).c_str(), NULL, 16); *p += 4; break;
+      }
+    }
+    out += c;
+  }
+  if (**p != '"') {
+    return false;
+  }
+  (*p)++;
+  return true;
+}
+
+static J *Parse_Value(const char **p)
+{
+  Parse_Space(p);
+  if (**p == '{' || **p == '[') {
+    bool object = (**p == '{');
+    char close = object ? '}' : ']';
+    J *item = object ? JCreateObject() : JCreateArray();
+    (*p)++;
+    Parse_Space(p);
+    if (**p == close) {
+      (*p)++;
+      return item;
+    }
+    for (;;) {
+      std::string name;
+      if (object) {
+        Parse_Space(p);
+        if (!Parse_String(p, name)) {
+          JDelete(item);
+          return NULL;
+        }
+        Parse_Space(p);
+        if (*(*p)++ != ':') {
+          JDelete(item);
+          return NULL;
+        }
+      }
+      J *child = Parse_Value(p);
+      if (child == NULL) {
+        JDelete(item);
+        return NULL;
+      }
+      if (object) {
+        JAddItemToObject(item, name.c_str(), child);
+      } else {
+        JAddItemToArray(item, child);
+      }
+      Parse_Space(p);
+      if (**p == ',') {
+        (*p)++;
+        continue;
+      }
+      if (**p == close) {
+        (*p)++;
+        return item;
+      }
+      JDelete(item);
+      return NULL;
+    }
+  }
+  if (**p == '"') {
+    std::string s;
+    return Parse_String(p, s) ? JCreateString(s.c_str()) : NULL;
+  }
+  if (strncmp(*p, "true", 4) == 0) {
+    *p += 4;
+    return JCreateBool(true);
+  }
+  if (strncmp(*p, "false", 5) == 0) {
+    *p += 5;
+    return JCreateBool(false);
+  }
+  if (strncmp(*p, "null", 4) == 0) {
+    *p += 4;
+    return J_New(JNULL);
+  }
+  char *end;
+  double number = strtod(*p, &end);
+  if (end == *p) {
+    return NULL;
+  }
+  *p = end;
+  return JCreateNumber(number);
+}
+
+J *JParse(const char *text)
+{
+  return (text != NULL) ? Parse_Value(&text) : NULL;
+}
+
+void NoteDeleteResponse(J *rsp)
+{
+  JDelete(rsp);
+}
+
+bool NoteResponseError(J *rsp)
+{
+  return rsp == NULL || JIsPresent(rsp, "err");
+}
+
+void NoteSetFn(mallocFn mallocHook, freeFn freeHook, delayMsFn delayHook, getMsFn millisHook)
+{
+  hookMalloc = mallocHook;
+  hookFree = freeHook;
+  hookDelay = delayHook;
+  hookMillis = millisHook;
+}
+
+void NoteGetFn(mallocFn *mallocHook, freeFn *freeHook, delayMsFn *delayHook, getMsFn *millisHook)
+{
+  *mallocHook = hookMalloc;
+  *freeHook = hookFree;
+  *delayHook = hookDelay;
+  *millisHook = hookMillis;
+}
+
+// Notecard
+
+static void Sync_Start()
+{
+  // A sync brings in the env changes and commands staged on Notehub, and
+  // the time if the Notecard did not have it
+  if (syncing) {
+    return;
+  }
+  syncing = true;
+  Sim_At_Us(Sim_Local_Us() + (uint64_t)(simWorld.syncS * 1e6), []() {
+    syncing = false;
+    lastSyncEndS = Sim_True_S();
+    simWorld.notecardTimeKnown = true;
+    if (!envStaged.empty()) {
+      for (auto &entry : envStaged) {
+        env[entry.first] = entry.second;
+      }
+      envStaged.clear();
+      envModifiedS = (uint32_t)Sim_True_S();
+    }
+    bool arrived = !commandsStaged.empty();
+    while (!commandsStaged.empty()) {
+      commands.push_back(commandsStaged.front());
+      commandsStaged.pop_front();
+    }
+    if (arrived && attnArmed) {
+      attnArmed = false;
+      Sim_Line_Set(SIM_NOTECARD_ATTN_PIN, HIGH);
+    }
+  });
+}
+
+static J *Location_Response()
+{
+  if (locationMode == "continuous" && fixAtUs != 0 && Sim_Local_Us() >= fixAtUs) {
+    fixValid = true;
+    fixTime = (uint32_t)Sim_True_At(fixAtUs);
+    fixAtUs += (uint64_t)GPS_FIX_PERIOD_S * 1000000;
+  }
+  J *rsp = JCreateObject();
+  JAddStringToObject(rsp, "mode", locationMode.c_str());
+  if (fixValid) {
+    JAddStringToObject(rsp, "status", "GPS updated {gps-active}");
+    JAddNumberToObject(rsp, "lat", simWorld.lat);
+    JAddNumberToObject(rsp, "lon", simWorld.lon);
+    JAddIntToObject(rsp, "time", fixTime);
+  } else {
+    JAddStringToObject(rsp, "status", (locationMode == "off") ? "GPS inactive {gps-inactive}" : "GPS search {gps-active}");
+  }
+  return rsp;
+}
+
+static J *Handle(const std::string &name, J *req)
+{
+  J *rsp = JCreateObject();
+  if (name == "card.time") {
+    if (simWorld.notecardTimeKnown) {
+      JAddIntToObject(rsp, "time", (JINTEGER)Sim_True_S());
+      JAddStringToObject(rsp, "zone", "UTC,Etc/UTC");
+    } else {
+      JAddStringToObject(rsp, "err", "time is not yet set {no-time}");
+    }
+  } else if (name == "hub.get") {
+    JAddStringToObject(rsp, "product", hubProduct.c_str());
+    JAddStringToObject(rsp, "mode", hubMode.c_str());
+    JAddStringToObject(rsp, "device", simWorld.deviceUID.c_str());
+  } else if (name == "hub.set") {
+    if (JIsPresent(req, "product")) {
+      hubProduct = JGetString(req, "product");
+    }
+    if (JIsPresent(req, "mode")) {
+      hubMode = JGetString(req, "mode");
+    }
+  } else if (name == "hub.sync") {
+    Sync_Start();
+  } else if (name == "hub.sync.status") {
+    if (syncing) {
+      JAddStringToObject(rsp, "status", "sync in progress {sync-begin}");
+      JAddBoolToObject(rsp, "sync", true);
+    } else if (lastSyncEndS >= 0) {
+      JAddStringToObject(rsp, "status", "completed {sync-end}");
+      JAddIntToObject(rsp, "completed", (JINTEGER)(Sim_True_S() - lastSyncEndS));
+    }
+  } else if (name == "note.add") {
+    SimNote note;
+    note.file = JGetString(req, "file");
+    note.trueS = Sim_True_S();
+    J *body = JGetObject(req, "body");
+    char *json = body ? JPrintUnformatted(body) : NULL;
+    note.body = json ? json : "{}";
+    JFree(json);
+    if (JGetBool(req, "binary")) {
+      if (binaryStore.empty()) {
+        JAddStringToObject(rsp, "err", "no binary data to attach {binary}");
+        return rsp;
+      }
+      note.binary.swap(binaryStore);
+    }
+    simNotes.push_back(note);
+    JAddIntToObject(rsp, "total", (JINTEGER)simNotes.size());
+    if (JGetBool(req, "sync")) {
+      Sync_Start();
+    }
+  } else if (name == "note.get") {
+    if (strcmp(JGetString(req, "file"), "commands.qi") != 0 || commands.empty()) {
+      JAddStringToObject(rsp, "err", "no notes available in queue {note-noexist}");
+    } else {
+      JAddItemToObject(rsp, "body", JParse(commands.front().c_str()));
+      JAddIntToObject(rsp, "time", (JINTEGER)Sim_True_S());
+      if (JGetBool(req, "delete")) {
+        commands.pop_front();
+      }
+    }
+  } else if (name == "env.modified") {
+    if (envModifiedS != 0) {
+      JAddIntToObject(rsp, "time", envModifiedS);
+    }
+  } else if (name == "env.get") {
+    J *body = JAddObjectToObject(rsp, "body");
+    for (auto &entry : env) {
+      JAddStringToObject(body, entry.first.c_str(), entry.second.c_str());
+    }
+    JAddIntToObject(rsp, "time", envModifiedS);
+  } else if (name == "card.location") {
+    JDelete(rsp);
+    rsp = Location_Response();
+  } else if (name == "card.location.mode") {
+    std::string mode = JGetString(req, "mode");
+    if (mode == "continuous" && locationMode != "continuous") {
+      fixAtUs = Sim_Local_Us() + (uint64_t)(simWorld.gpsFixS * 1e6);
+    } else if (mode != "continuous") {
+      fixAtUs = 0;
+    }
+    if (!mode.empty()) {
+      locationMode = mode;
+    }
+    JAddStringToObject(rsp, "mode", locationMode.c_str());
+  } else if (name == "card.attn") {
+    if (strstr(JGetString(req, "mode"), "arm") != NULL) {
+      attnArmed = true;
+      Sim_Line_Set(SIM_NOTECARD_ATTN_PIN, LOW);
+    }
+  } else if (name == "card.binary") {
+    if (JGetBool(req, "delete")) {
+      binaryStore.clear();
+    }
+    JAddIntToObject(rsp, "length", (JINTEGER)binaryStore.size());
+    JAddIntToObject(rsp, "max", 130554);
+  }
+  return rsp;
+}
+
+static uint64_t Wire_Us(size_t bytes)
+{
+  return (uint64_t)bytes * 10 * 1000000 / uartBaud;  // Start, 8 data and stop bits
+}
+
+static J *Transact(J *req, size_t payloadBytes)
+{
+  // Send the request (and any binary payload after it), let the Notecard
+  // work, read the response back
+  Sim_Activity();
+  std::string name = JGetString(req, "req");
+  SimRequest record = { name, Sim_True_S(), 0, 0, false };
+  char *json = JPrintUnformatted(req);
+  record.txBytes = strlen(json) + 1 + payloadBytes;
+  if (debugStream) {
+    debugStream->println(json);
+  }
+  JFree(json);
+  Sim_Advance_Us(Wire_Us(record.txBytes));
+
+  if (!simWorld.notecardOnline) {
+    Sim_Advance_Us((uint64_t)(simWorld.notecardTimeoutS * 1e6));
+    simRequests.push_back(record);
+    JDelete(req);
+    return NULL;
+  }
+
+  J *rsp = Handle(name, req);
+  JDelete(req);
+  uint64_t processUs = NOTECARD_PROCESS_US;
+  if (name == "note.add") {
+    processUs = NOTECARD_NOTE_ADD_US;
+  } else if (name == "card.binary.put") {
+    processUs = NOTECARD_BINARY_PUT_US;
+  }
+  json = JPrintUnformatted(rsp);
+  record.rxBytes = strlen(json) + 1;
+  record.answered = true;
+  Sim_Advance_Us(processUs + Wire_Us(record.rxBytes));
+  if (debugStream) {
+    debugStream->println(json);
+  }
+  JFree(json);
+  simRequests.push_back(record);
+  return rsp;
+}
+
+static void Hook_Delay(uint32_t ms)
+{
+  delay(ms);
+}
+
+static uint32_t Hook_Millis()
+{
+  return (uint32_t)millis();
+}
+
+void Notecard::begin(HardwareSerial &serial, uint32_t speed)
+{
+  (void)serial;
+  uartBaud = speed;
+  NoteSetFn(malloc, free, Hook_Delay, Hook_Millis);
+}
+
+void Notecard::begin(uint32_t i2cAddress, uint32_t i2cMax, TwoWire &wire)
+{
+  (void)i2cAddress;
+  (void)i2cMax;
+  (void)wire;
+  uartBaud = 444444;  // 400 kHz I2C moves a byte per 9 clocks, Wire_Us() counts 10 bits
+  NoteSetFn(malloc, free, Hook_Delay, Hook_Millis);
+}
+
+void Notecard::setDebugOutputStream(Stream &stream)
+{
+  debugStream = &stream;
+}
+
+J *Notecard::newRequest(const char *request)
+{
+  J *req = JCreateObject();
+  JAddStringToObject(req, "req", request);
+  return req;
+}
+
+J *Notecard::newCommand(const char *request)
+{
+  J *req = JCreateObject();
+  JAddStringToObject(req, "cmd", request);
+  return req;
+}
+
+J *Notecard::requestAndResponse(J *req)
+{
+  return (req != NULL) ? Transact(req, 0) : NULL;
+}
+
+bool Notecard::sendRequest(J *req)
+{
+  J *rsp = requestAndResponse(req);
+  bool success = !NoteResponseError(rsp);
+  JDelete(rsp);
+  return success;
+}
+
+void Notecard::deleteResponse(J *rsp)
+{
+  JDelete(rsp);
+}
+
+bool Notecard::responseError(J *rsp)
+{
+  return NoteResponseError(rsp);
+}
+
+uint32_t NoteBinaryCodecMaxEncodedLength(uint32_t unencodedLength)
+{
+  // COBS adds a byte per 254 and one more, plus the terminator
+  return unencodedLength + unencodedLength / 254 + 2;
+}
+
+const char *NoteBinaryStoreReset(void)
+{
+  J *req = JCreateObject();
+  JAddStringToObject(req, "req", "card.binary");
+  JAddBoolToObject(req, "delete", true);
+  J *rsp = Transact(req, 0);
+  bool failed = NoteResponseError(rsp);
+  JDelete(rsp);
+  return failed ? "failed to reset binary buffer" : NULL;
+}
+
+const char *NoteBinaryStoreTransmit(uint8_t *buffer, uint32_t dataLen, uint32_t bufferLen, uint32_t offset)
+{
+  // Check the Notecard's length against offset, encode in place and send
+  // the chunk in one card.binary.put
+  uint32_t encodedLen = NoteBinaryCodecMaxEncodedLength(dataLen);
+  if (bufferLen < encodedLen) {
+    return "output buffer too small for the encoding";
+  }
+  J *req = JCreateObject();
+  JAddStringToObject(req, "req", "card.binary");
+  J *rsp = Transact(req, 0);
+  if (rsp == NULL) {
+    return "failed to get binary buffer length";
+  }
+  uint32_t length = JGetInt(rsp, "length");
+  JDelete(rsp);
+  if (length != offset) {
+    return "notecard data length is misaligned with offset";
+  }
+
+  std::vector<uint8_t> chunk(buffer, buffer + dataLen);
+  memset(buffer, 0xEE, encodedLen);  // The caller's data is gone once encoded
+  req = JCreateObject();
+  JAddStringToObject(req, "req", "card.binary.put");
+  JAddIntToObject(req, "cobs", encodedLen);
+  JAddIntToObject(req, "offset", offset);
+  rsp = Transact(req, encodedLen);
+  bool failed = NoteResponseError(rsp);
+  JDelete(rsp);
+  if (failed) {
+    return "failed to send binary chunk";
+  }
+  binaryStore.insert(binaryStore.end(), chunk.begin(), chunk.end());
+  return NULL;
+}
+
+// Control
+
+void Sim_Env_Set(const char *name, const char *value, bool staged)
+{
+  if (staged) {
+    envStaged[name] = value;
+  } else {
+    env[name] = value;
+    envModifiedS = (uint32_t)Sim_True_S();
+  }
+}
+
+void Sim_Command_Queue(const char *json, bool staged)
+{
+  (staged ? commandsStaged : commands).push_back(json);
+}
+
+size_t Sim_Requests(const char *name)
+{
+  size_t n = 0;
+  for (const SimRequest &r : simRequests) {
+    n += (r.name == name);
+  }
+  return n;
+}
+
+std::vector<const SimNote *> Sim_Notes(const char *file)
+{
+  std::vector<const SimNote *> notes;
+  for (const SimNote &note : simNotes) {
+    if (note.file == file) {
+      notes.push_back(&note);
+    }
+  }
+  return notes;
+}
+
+bool Sim_Syncing()
+{
+  return syncing;
+}
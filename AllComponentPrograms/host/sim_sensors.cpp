@@ -0,0 +1,656 @@
+// Qwiic mux, INA260, AHTX0 and PMSA003I fakes behind a byte-level Wire.
+// Transfers cost 9 bus clocks per byte, address included, at the clock set
+// with Wire.setClock(), and are counted in simI2cTransactions and
+// simI2cBytes; devices answer from the mux port(s) enabled.
+#include <Adafruit_AHTX0.h>
+#include <Adafruit_INA260.h>
+#include <Adafruit_PM25AQI.h>
+#include <SparkFun_I2C_Mux_Arduino_Library.h>
+#include "sim_internal.h"
+
+#define MUX_ADDR 0x70
+#define INA260_ADDR 0x40
+#define AHTX0_ADDR 0x38
+#define PMSA003I_ADDR 0x12
+#define PMSA003I_FRAME_US 1000000  // New frame about once a second while running
+#define AHTX0_MEASURE_MS 80
+#define I2C_STANDARD_MAX_HZ 100000
+
+TwoWire Wire;
+unsigned long simI2cFastPmTransfers = 0;
+unsigned long simI2cTransactions = 0;
+unsigned long simI2cBytes = 0;
+
+struct Ina260Device {
+  uint16_t config;  // Configuration register
+  uint16_t maskEnable;  // Alert function bits; CVRF is returned on read
+  bool conversionFlag;  // CVRF, cleared by reading Mask/Enable
+  bool alertAsserted;  // Holding the shared ALERT line low
+  uint64_t startUs;  // Conversions restart from here on a config write
+  uint32_t generation;  // Cancels the pending alert event of an older config
+  uint8_t pointer;  // Register pointer
+};
+
+struct Ahtx0Device {
+  uint32_t rawHumidity, rawTemperature;  // 20-bit readings of the last measurement
+};
+
+static bool busHeld = false;  // Last transfer ended without a stop; the next is a repeated start
+static uint8_t muxState = 0;  // TCA9548A control register: enabled ports
+static unsigned long busHz = I2C_STANDARD_MAX_HZ;
+static Ina260Device ina260[SIM_MUX_PORTS];
+static Ahtx0Device ahtx0[SIM_MUX_PORTS];
+static bool pmRunning = false;
+static uint64_t pmWakeUs = 0;  // When SET last went high
+static uint64_t pmFrozenFrame = 0;  // Time of the last frame before the sensor slept, returned while asleep
+static bool pmFrozenValid = false;
+static uint64_t fanOnUs = 0;
+
+[[maybe_unused]] static bool ina260PowerOn = []() {
+  for (int port = 0; port < SIM_MUX_PORTS; port++) {
+    ina260[port].config = 0x6127;  // 1 average, 1.1 ms conversions, continuous
+  }
+  return true;
+}();
+static const uint16_t ina260ConversionUs[8] = { 140, 204, 332, 588, 1100, 2116, 4156, 8244 };
+static const uint16_t ina260Averages[8] = { 1, 4, 16, 64, 128, 256, 512, 1024 };
+
+static int Port_With(uint8_t addr)
+{
+  // Lowest enabled mux port with a device at addr, -1 if none answers
+  uint8_t ports = 0;
+  switch (addr) {
+    case INA260_ADDR: ports = simWorld.ina260Ports; break;
+    case AHTX0_ADDR: ports = simWorld.ahtx0Ports; break;
+    case PMSA003I_ADDR: ports = simWorld.pm25aqiPorts; break;
+  }
+  ports &= muxState;
+  for (int port = 0; port < SIM_MUX_PORTS; port++) {
+    if (ports & (1 << port)) {
+      return port;
+    }
+  }
+  return -1;
+}
+
+static void Bus_Transfer(uint8_t addr, size_t bytes, bool sendStop)
+{
+  // Address byte plus data, 9 clocks each including the ACK
+  Sim_Activity();
+  if (!busHeld) {
+    simI2cTransactions++;
+  }
+  simI2cBytes += bytes;
+  busHeld = !sendStop;
+  if (addr != MUX_ADDR && busHz > I2C_STANDARD_MAX_HZ && (simWorld.pm25aqiPorts & muxState)) {
+    simI2cFastPmTransfers++;
+  }
+  Sim_Advance_Us((uint64_t)(bytes + 1) * 9 * 1000000 / busHz);
+}
+
+// INA260
+
+static uint64_t Ina260_Period_Us(const Ina260Device *d)
+{
+  uint8_t averages = (d->config >> 9) & 7;
+  uint8_t busTime = (d->config >> 6) & 7;
+  uint8_t shuntTime = (d->config >> 3) & 7;
+  return (uint64_t)ina260Averages[averages] * (ina260ConversionUs[busTime] + ina260ConversionUs[shuntTime]);
+}
+
+static void Ina260_Update_Line()
+{
+  // Open-drain outputs wired together: low while any device asserts
+  bool low = false;
+  for (int port = 0; port < SIM_MUX_PORTS; port++) {
+    if ((simWorld.ina260Ports & (1 << port)) && ina260[port].alertAsserted) {
+      low = true;
+    }
+  }
+  Sim_Line_Set(SIM_INA260_ALERT_PIN, low ? LOW : HIGH);
+}
+
+static void Ina260_Schedule(int port)
+{
+  // With the conversion-ready alert enabled, each finished conversion sets
+  // CVRF and pulls ALERT low until Mask/Enable is read
+  Ina260Device *d = &ina260[port];
+  if (!(d->maskEnable & 0x0400)) {
+    return;
+  }
+  uint64_t period = Ina260_Period_Us(d);
+  uint64_t done = (Sim_Local_Us() - d->startUs) / period + 1;
+  uint32_t generation = d->generation;
+  Sim_At_Us(d->startUs + done * period, [port, generation]() {
+    Ina260Device *d = &ina260[port];
+    if (d->generation != generation) {
+      return;
+    }
+    d->conversionFlag = true;
+    d->alertAsserted = true;
+    Ina260_Update_Line();
+    Ina260_Schedule(port);
+  });
+}
+
+static void Ina260_Reset(int port)
+{
+  Ina260Device *d = &ina260[port];
+  d->config = 0x6127;  // 1 average, 1.1 ms conversions, continuous
+  d->maskEnable = 0;
+  d->conversionFlag = false;
+  d->alertAsserted = false;
+  d->startUs = Sim_Local_Us();
+  d->generation++;
+  Ina260_Update_Line();
+}
+
+static bool Ina260_Conversion(int port, double *currentMa, double *voltageMv)
+{
+  // Registers hold the last finished conversion; the readings are taken
+  // at its end, the averaging window being short next to how they change
+  Ina260Device *d = &ina260[port];
+  uint64_t period = Ina260_Period_Us(d);
+  uint64_t done = (Sim_Local_Us() - d->startUs) / period;
+  if (done == 0) {
+    *currentMa = *voltageMv = 0;
+    return false;
+  }
+  double t = Sim_True_At(d->startUs + done * period);
+  *currentMa = simWorld.currentMa(port, t);
+  *voltageMv = simWorld.voltageMv(port, t);
+  return true;
+}
+
+static uint16_t Ina260_Read_Register(int port, uint8_t reg)
+{
+  Ina260Device *d = &ina260[port];
+  double currentMa, voltageMv;
+  switch (reg) {
+    case 0x00:
+      return d->config;
+    case 0x01:
+      Ina260_Conversion(port, &currentMa, &voltageMv);
+      return (uint16_t)(int16_t)lround(currentMa / 1.25);
+    case 0x02:
+      Ina260_Conversion(port, &currentMa, &voltageMv);
+      return (uint16_t)lround(voltageMv / 1.25);
+    case 0x03:
+      Ina260_Conversion(port, &currentMa, &voltageMv);
+      return (uint16_t)lround(fabs(currentMa) * voltageMv / 1000.0 / 10);
+    case 0x06: {
+      uint16_t value = d->maskEnable | (d->conversionFlag ? 0x0008 : 0);
+      d->conversionFlag = false;
+      d->alertAsserted = false;
+      Ina260_Update_Line();
+      return value;
+    }
+    case 0xFE:
+      return 0x5449;  // Texas Instruments
+    case 0xFF:
+      return 0x2270;
+  }
+  return 0;
+}
+
+static void Ina260_Write_Register(int port, uint8_t reg, uint16_t value)
+{
+  Ina260Device *d = &ina260[port];
+  if (reg == 0x00) {
+    if (value & 0x8000) {
+      Ina260_Reset(port);
+      return;
+    }
+    d->config = value;
+  } else if (reg == 0x06) {
+    d->maskEnable = value & 0xFC03;
+  } else {
+    return;
+  }
+  // A config or Mask/Enable write starts a fresh conversion
+  d->startUs = Sim_Local_Us();
+  d->generation++;
+  Ina260_Schedule(port);
+}
+
+// PMSA003I
+
+void Sim_Set_Pin_Written(uint8_t pin, int level)
+{
+  if (pin != SIM_PM25AQI_SET_PIN || (level == HIGH) == pmRunning) {
+    return;
+  }
+  uint64_t now = Sim_Local_Us();
+  if (level == HIGH) {
+    pmRunning = true;
+    pmWakeUs = now;
+  } else {
+    pmRunning = false;
+    fanOnUs += now - pmWakeUs;
+    uint64_t frames = (now - pmWakeUs) / PMSA003I_FRAME_US;
+    if (frames > 0) {
+      pmFrozenFrame = pmWakeUs + frames * PMSA003I_FRAME_US;
+      pmFrozenValid = true;
+    }
+  }
+}
+
+double Sim_Fan_On_S()
+{
+  return (fanOnUs + (pmRunning ? Sim_Local_Us() - pmWakeUs : 0)) / 1e6;
+}
+
+bool Sim_Fan_On()
+{
+  return pmRunning;
+}
+
+static void Pm25aqi_Frame(int port, uint8_t *frame)
+{
+  // 32-byte frame: "BM", length, 13 big-endian words, checksum of the rest.
+  // Asleep the sensor keeps returning its last frame.
+  memset(frame, 0, 32);
+  uint64_t frameUs;
+  if (pmRunning && Sim_Local_Us() - pmWakeUs >= PMSA003I_FRAME_US) {
+    frameUs = pmWakeUs + (Sim_Local_Us() - pmWakeUs) / PMSA003I_FRAME_US * PMSA003I_FRAME_US;
+  } else if (pmFrozenValid) {
+    frameUs = pmFrozenFrame;
+  } else {
+    return;  // No frame since power-up
+  }
+  double pm25 = simWorld.pm25(port, Sim_True_At(frameUs));
+  const double ratio[12] = { 0.8, 1, 1.2, 0.8, 1, 1.2, 150, 45, 8, 1.5, 0.3, 0.1 };
+  uint16_t words[14];
+  words[0] = 28;
+  for (int f = 0; f < 12; f++) {
+    words[f + 1] = (uint16_t)lround(pm25 * ratio[f]);
+  }
+  words[13] = 0x9700;  // Version and error code
+  frame[0] = 0x42;
+  frame[1] = 0x4D;
+  for (int w = 0; w < 14; w++) {
+    frame[2 + 2 * w] = words[w] >> 8;
+    frame[3 + 2 * w] = words[w] & 0xFF;
+  }
+  uint16_t sum = 0;
+  for (int i = 0; i < 30; i++) {
+    sum += frame[i];
+  }
+  frame[30] = sum >> 8;
+  frame[31] = sum & 0xFF;
+}
+
+// AHTX0
+
+static void Ahtx0_Measure(int port)
+{
+  // 20-bit readings: RH = raw / 2^20 x 100, T = raw / 2^20 x 200 - 50
+  double t = Sim_True_S();
+  double rh = simWorld.humidityRh(port, t);
+  double c = simWorld.temperatureC(port, t);
+  ahtx0[port].rawHumidity = (uint32_t)lround(rh / 100 * ((1 << 20) - 1));
+  ahtx0[port].rawTemperature = (uint32_t)lround((c + 50) / 200 * ((1 << 20) - 1));
+}
+
+// Wire
+
+void TwoWire::begin()
+{
+  busHz = I2C_STANDARD_MAX_HZ;
+}
+
+void TwoWire::setClock(uint32_t hz)
+{
+  busHz = hz;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t value)
+{
+  if (txLength >= sizeof(txBuffer)) {
+    return 0;
+  }
+  txBuffer[txLength++] = value;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (n < size && write(buffer[n])) {
+    n++;
+  }
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  Bus_Transfer(txAddress, txLength, sendStop);
+  if (txAddress == MUX_ADDR) {
+    if (!simWorld.muxPresent) {
+      return 2;
+    }
+    if (txLength > 0) {
+      muxState = txBuffer[0];
+    }
+    return 0;
+  }
+  int port = Port_With(txAddress);
+  if (port < 0) {
+    return 2;  // NACK on the address
+  }
+  if (txAddress == INA260_ADDR && txLength >= 1) {
+    ina260[port].pointer = txBuffer[0];
+    if (txLength >= 3) {
+      Ina260_Write_Register(port, txBuffer[0], (txBuffer[1] << 8) | txBuffer[2]);
+    }
+  }
+  if (txAddress == AHTX0_ADDR && txLength >= 1 && txBuffer[0] == 0xAC) {
+    Ahtx0_Measure(port);
+  }
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool sendStop)
+{
+  rxLength = rxIndex = 0;
+  if (quantity > sizeof(rxBuffer)) {
+    quantity = sizeof(rxBuffer);
+  }
+  Bus_Transfer(address, quantity, sendStop);
+  if (address == MUX_ADDR) {
+    if (!simWorld.muxPresent) {
+      return 0;
+    }
+    rxBuffer[0] = muxState;
+    rxLength = 1;
+    return rxLength;
+  }
+  int port = Port_With(address);
+  if (port < 0) {
+    return 0;
+  }
+  uint8_t data[32] = {};
+  if (address == INA260_ADDR) {
+    uint16_t value = Ina260_Read_Register(port, ina260[port].pointer);
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+  } else if (address == AHTX0_ADDR) {
+    // Status (calibrated, idle), then 20-bit humidity and temperature
+    uint32_t h = ahtx0[port].rawHumidity;
+    uint32_t t = ahtx0[port].rawTemperature;
+    data[0] = 0x18;
+    data[1] = h >> 12;
+    data[2] = h >> 4;
+    data[3] = ((h & 0x0F) << 4) | (t >> 16);
+    data[4] = t >> 8;
+    data[5] = t & 0xFF;
+  } else if (address == PMSA003I_ADDR) {
+    Pm25aqi_Frame(port, data);
+  }
+  memcpy(rxBuffer, data, quantity);
+  rxLength = quantity;
+  return rxLength;
+}
+
+int TwoWire::available()
+{
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read()
+{
+  return (rxIndex < rxLength) ? rxBuffer[rxIndex++] : -1;
+}
+
+// Libraries, written against Wire the way the real ones are
+
+static bool Register_Read16(uint8_t addr, uint8_t reg, uint16_t *value)
+{
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0 || Wire.requestFrom(addr, (size_t)2) != 2) {
+    return false;
+  }
+  *value = Wire.read() << 8;
+  *value |= Wire.read();
+  return true;
+}
+
+static void Register_Write16(uint8_t addr, uint8_t reg, uint16_t value)
+{
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  Wire.write(value >> 8);
+  Wire.write(value & 0xFF);
+  Wire.endTransmission();
+}
+
+static void Register_Bits(uint8_t addr, uint8_t reg, uint16_t mask, uint16_t bits)
+{
+  uint16_t value;
+  if (Register_Read16(addr, reg, &value)) {
+    Register_Write16(addr, reg, (value & ~mask) | (bits & mask));
+  }
+}
+
+bool Adafruit_INA260::begin(uint8_t i2cAddr, TwoWire *theWire)
+{
+  (void)i2cAddr;
+  (void)theWire;
+  uint16_t id;
+  if (!Register_Read16(INA260_ADDR, 0xFE, &id) || id != 0x5449) {
+    return false;
+  }
+  Register_Write16(INA260_ADDR, 0x00, 0x8000);  // Reset
+  delay(2);
+  return true;
+}
+
+float Adafruit_INA260::readCurrent()
+{
+  uint16_t raw = 0;
+  Register_Read16(INA260_ADDR, 0x01, &raw);
+  return (int16_t)raw * 1.25;
+}
+
+float Adafruit_INA260::readBusVoltage()
+{
+  uint16_t raw = 0;
+  Register_Read16(INA260_ADDR, 0x02, &raw);
+  return raw * 1.25;
+}
+
+float Adafruit_INA260::readPower()
+{
+  uint16_t raw = 0;
+  Register_Read16(INA260_ADDR, 0x03, &raw);
+  return raw * 10.0;
+}
+
+void Adafruit_INA260::setMode(INA260_MeasurementMode mode)
+{
+  Register_Bits(INA260_ADDR, 0x00, 0x0007, mode);
+}
+
+void Adafruit_INA260::setAveragingCount(INA260_AveragingCount count)
+{
+  Register_Bits(INA260_ADDR, 0x00, 0x0E00, count << 9);
+}
+
+void Adafruit_INA260::setCurrentConversionTime(INA260_ConversionTime time)
+{
+  Register_Bits(INA260_ADDR, 0x00, 0x0038, time << 3);
+}
+
+void Adafruit_INA260::setVoltageConversionTime(INA260_ConversionTime time)
+{
+  Register_Bits(INA260_ADDR, 0x00, 0x01C0, time << 6);
+}
+
+void Adafruit_INA260::setAlertType(INA260_AlertType alert)
+{
+  Register_Bits(INA260_ADDR, 0x06, 0xFC00, alert << 10);
+}
+
+void Adafruit_INA260::setAlertPolarity(INA260_AlertPolarity polarity)
+{
+  Register_Bits(INA260_ADDR, 0x06, 0x0002, polarity << 1);
+}
+
+void Adafruit_INA260::setAlertLatch(INA260_AlertLatch latch)
+{
+  Register_Bits(INA260_ADDR, 0x06, 0x0001, latch);
+}
+
+bool Adafruit_INA260::conversionReady()
+{
+  uint16_t value = 0;
+  Register_Read16(INA260_ADDR, 0x06, &value);
+  return value & 0x0008;
+}
+
+bool Adafruit_INA260::alertFunctionFlag()
+{
+  uint16_t value = 0;
+  Register_Read16(INA260_ADDR, 0x06, &value);
+  return value & 0x0010;
+}
+
+bool Adafruit_AHTX0::begin(TwoWire *wire, int32_t sensorId, uint8_t i2cAddress)
+{
+  (void)wire;
+  (void)sensorId;
+  (void)i2cAddress;
+  delay(20);  // Power-on
+  Wire.beginTransmission(AHTX0_ADDR);
+  Wire.write(0xBA);  // Soft reset
+  if (Wire.endTransmission() != 0) {
+    return false;
+  }
+  delay(20);
+  Wire.beginTransmission(AHTX0_ADDR);
+  Wire.write(0xE1);  // Calibrate
+  Wire.write(0x08);
+  Wire.write(0x00);
+  Wire.endTransmission();
+  delay(10);
+  return Wire.requestFrom((uint8_t)AHTX0_ADDR, (size_t)1) == 1 && (Wire.read() & 0x08);
+}
+
+bool Adafruit_AHTX0::getEvent(sensors_event_t *humidity, sensors_event_t *temp)
+{
+  // Trigger, wait out the measurement, read status and both readings
+  Wire.beginTransmission(AHTX0_ADDR);
+  Wire.write(0xAC);
+  Wire.write(0x33);
+  Wire.write(0x00);
+  if (Wire.endTransmission() != 0) {
+    return false;
+  }
+  delay(AHTX0_MEASURE_MS);
+  if (Wire.requestFrom((uint8_t)AHTX0_ADDR, (size_t)6) != 6) {
+    return false;
+  }
+  uint8_t data[6];
+  for (int i = 0; i < 6; i++) {
+    data[i] = Wire.read();
+  }
+  uint32_t h = ((uint32_t)data[1] << 12) | ((uint32_t)data[2] << 4) | (data[3] >> 4);
+  uint32_t t = (((uint32_t)data[3] & 0x0F) << 16) | ((uint32_t)data[4] << 8) | data[5];
+  memset(humidity, 0, sizeof(*humidity));
+  memset(temp, 0, sizeof(*temp));
+  humidity->relative_humidity = h * 100.0 / (1 << 20);
+  temp->temperature = t * 200.0 / (1 << 20) - 50;
+  return true;
+}
+
+bool Adafruit_PM25AQI::begin_I2C(TwoWire *theWire)
+{
+  (void)theWire;
+  Wire.beginTransmission(PMSA003I_ADDR);
+  return Wire.endTransmission() == 0;
+}
+
+bool Adafruit_PM25AQI::read(PM25_AQI_Data *data)
+{
+  uint8_t buffer[32];
+  if (Wire.requestFrom((uint8_t)PMSA003I_ADDR, (size_t)32) != 32) {
+    return false;
+  }
+  for (int i = 0; i < 32; i++) {
+    buffer[i] = Wire.read();
+  }
+  if (buffer[0] != 0x42) {
+    return false;
+  }
+  uint16_t sum = 0;
+  for (int i = 0; i < 30; i++) {
+    sum += buffer[i];
+  }
+  uint16_t words[15];
+  for (int w = 0; w < 15; w++) {
+    words[w] = (buffer[2 + 2 * w] << 8) | buffer[3 + 2 * w];
+  }
+  memcpy(data, words, sizeof(words));
+  return sum == data->checksum;
+}
+
+bool QWIICMUX::begin(uint8_t deviceAddress, TwoWire &wirePort)
+{
+  (void)wirePort;
+  address = deviceAddress;
+  return isConnected();
+}
+
+bool QWIICMUX::isConnected()
+{
+  Wire.beginTransmission(address);
+  return Wire.endTransmission() == 0;
+}
+
+bool QWIICMUX::setPort(uint8_t portNumber)
+{
+  return setPortState(portNumber < SIM_MUX_PORTS ? 1 << portNumber : 0);
+}
+
+uint8_t QWIICMUX::getPort()
+{
+  uint8_t state = getPortState();
+  for (uint8_t port = 0; port < SIM_MUX_PORTS; port++) {
+    if (state & (1 << port)) {
+      return port;
+    }
+  }
+  return 255;
+}
+
+bool QWIICMUX::enablePort(uint8_t portNumber)
+{
+  return setPortState(getPortState() | (1 << portNumber));
+}
+
+bool QWIICMUX::disablePort(uint8_t portNumber)
+{
+  return setPortState(getPortState() & ~(1 << portNumber));
+}
+
+bool QWIICMUX::setPortState(uint8_t portBits)
+{
+  Wire.beginTransmission(address);
+  Wire.write(portBits);
+  return Wire.endTransmission() == 0;
+}
+
+uint8_t QWIICMUX::getPortState()
+{
+  if (Wire.requestFrom(address, (size_t)1) != 1) {
+    return 0;
+  }
+  return Wire.read();
+}
@@ -0,0 +1,76 @@
+// Included after ../mux_final_program.cpp by the simulator and the tests:
+// ties the sketch's pin numbers to the fakes' and reads its debug output
+#pragma once
+#include <stdlib.h>
+#include "sim.h"
+#if DEBUG_DEFERRED
+#include "log_decode.h"
+#endif
+
+static_assert(PM25AQI_SET_PIN == SIM_PM25AQI_SET_PIN, "sim_sensors.cpp watches a different SET pin");
+static_assert(INA260_ALERT_PIN == SIM_INA260_ALERT_PIN, "sim_sensors.cpp drives a different ALERT pin");
+static_assert(NOTECARD_ATTN_PIN == SIM_NOTECARD_ATTN_PIN, "sim_notecard.cpp drives a different ATTN pin");
+static_assert(MUX_PORTS == SIM_MUX_PORTS, "The fake mux has a different number of ports");
+
+// What the sketch printed, as text; a DEBUG_DEFERRED build's binary log is
+// decoded first
+inline std::string Sim_Serial_Text()
+{
+#if DEBUG_DEFERRED
+  LogDecoder decoder;
+  return decoder.Add(simSerialOut);
+#else
+  return simSerialOut;
+#endif
+}
+
+// One row of the Report_Cycle() table (needs DEBUG, with or without DEBUG_DEFERRED)
+struct CycleRow {
+  unsigned long cycle, awakeMs, ncTxn, txBytes, rxBytes, i2cTxn, i2cBytes, i2cUs, skipped, missed;
+};
+
+inline std::vector<CycleRow> Sim_Cycle_Rows()
+{
+  // Rows are ten tab-separated integers on their own line
+  std::vector<CycleRow> rows;
+  std::string serial = Sim_Serial_Text();
+  size_t start = 0;
+  while (start < serial.size()) {
+    size_t end = serial.find('\n', start);
+    if (end == std::string::npos) {
+      break;
+    }
+    std::string line = serial.substr(start, end - start);
+    start = end + 1;
+    unsigned long v[10];
+    const char *p = line.c_str();
+    int n = 0;
+    for (; n < 10; n++) {
+      char *next;
+      v[n] = strtoul(p, &next, 10);
+      if (next == p || (*next != '\t' && *next != '\r' && *next != '\0')) {
+        break;
+      }
+      p = (*next == '\t') ? next + 1 : next;
+      if (*next != '\t') {
+        n++;
+        break;
+      }
+    }
+    if (n == 10 && (*p == '\r' || *p == '\0')) {
+      rows.push_back({ v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9] });
+    }
+  }
+  return rows;
+}
+
+// Value printed after a "label: " line, or -1 if the sketch never printed it
+inline double Sim_Printed(const char *label)
+{
+  std::string serial = Sim_Serial_Text();
+  size_t at = serial.find(label);
+  if (at == std::string::npos) {
+    return -1;
+  }
+  return strtod(serial.c_str() + at + strlen(label), NULL);
+}
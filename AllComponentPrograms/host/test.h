@@ -0,0 +1,129 @@
+// Minimal test support. Every scenario runs in a forked child so that it
+// starts from the sketch's power-on state, and may freeze or hang without
+// taking the rest of the test binary with it.
+#pragma once
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include "sim.h"
+
+static int testFailures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+  do { \
+    double a_ = (a), b_ = (b); \
+    if (fabs(a_ - b_) > (tolerance)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s = %g, expected %g +/- %g\n", __FILE__, __LINE__, #a, a_, b_, \
+              (double)(tolerance)); \
+      testFailures++; \
+    } \
+  } while (0)
+
+// Number after "key": in a note body, or NAN if the body has no such key
+inline double Json_Number(const std::string &body, const char *key)
+{
+  std::string quoted = std::string("\"") + key + "\":";
+  size_t at = body.find(quoted);
+  if (at == std::string::npos) {
+    return NAN;
+  }
+  return strtod(body.c_str() + at + quoted.size(), NULL);
+}
+
+struct ForkResult {
+  bool passed;  // Exited normally with every CHECK passing
+  bool timedOut;  // Still running when the timeout ran out
+  std::string serial;  // What the sketch printed
+};
+
+static int testPipe = -1;
+
+static void Test_Send_Serial()
+{
+  size_t sent = 0;
+  while (sent < simSerialOut.size()) {
+    ssize_t n = write(testPipe, simSerialOut.data() + sent, simSerialOut.size() - sent);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+}
+
+static void Test_Timeout(int)
+{
+  Test_Send_Serial();
+  _exit(124);
+}
+
+// Runs body in a child process, killing it after timeoutS
+inline ForkResult Test_Fork(std::function<void()> body, unsigned timeoutS = 60)
+{
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(2);
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    testPipe = fds[1];
+    testFailures = 0;  // Only this scenario's own
+    signal(SIGALRM, Test_Timeout);
+    alarm(timeoutS);
+    body();
+    alarm(0);
+    Test_Send_Serial();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(testFailures ? 1 : 0);
+  }
+  close(fds[1]);
+  ForkResult result = { false, false, "" };
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    result.serial.append(buffer, n);
+  }
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  result.timedOut = WIFEXITED(status) && WEXITSTATUS(status) == 124;
+  result.passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  return result;
+}
+
+// Reports a scenario that is expected to pass
+inline void Test_Run(const char *name, std::function<void()> body, unsigned timeoutS = 60)
+{
+  ForkResult result = Test_Fork(body, timeoutS);
+  printf("%s %s\n", result.passed ? "PASS" : "FAIL", name);
+  if (!result.passed) {
+    testFailures++;
+    if (result.timedOut) {
+      printf("  timed out after %u s\n", timeoutS);
+    }
+  }
+}
+
+inline int Test_Result()
+{
+  printf("%s\n", testFailures ? "FAILED" : "OK");
+  return testFailures ? 1 : 0;
+}
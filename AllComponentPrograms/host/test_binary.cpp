@@ -0,0 +1,79 @@
+// BINARY_UPLOAD: burst records go out as CRC-checked blocks through the
+// fake Notecard's binary buffer, one card.binary.put per block, and each
+// block decodes back to the records the sketch stored
+#define DEBUG 1
+#define BINARY_UPLOAD 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Burst_Blocks()
+{
+  simWorld.currentMa = [](int, double t) { return 150 + fmod(t, 60); };
+  Sim_Command_Queue("{\"cmd\":\"burst\",\"minutes\":40,\"cadence_s\":60}");
+  Sim_Run(Sim_True_S() + 2 * 3600);
+
+  std::vector<const SimNote *> blocks = Sim_Notes("burst.qo");
+  CHECK(blocks.size() == 3);  // Two full blocks, then the rest when the burst ends
+  CHECK(Sim_Requests("card.binary.put") == blocks.size());
+
+  size_t records = 0;
+  uint32_t lastTime = 0;
+  for (const SimNote *block : blocks) {
+    // Header, then the records oldest first
+    BinaryBlockHeader header;
+    CHECK(block->binary.size() >= sizeof(header));
+    if (block->binary.size() < sizeof(header)) {
+      continue;
+    }
+    memcpy(&header, block->binary.data(), sizeof(header));
+    CHECK(header.magic[0] == 'A' && header.magic[1] == 'Q' && header.version == 1);
+    CHECK(header.recordBytes == sizeof(SampleRecord));
+    CHECK(block->binary.size() == sizeof(header) + header.records * sizeof(SampleRecord));
+    if (block->binary.size() != sizeof(header) + header.records * sizeof(SampleRecord)) {
+      continue;
+    }
+    CHECK(header.records == Json_Number(block->body, "records"));
+    CHECK(header.firstTime == Json_Number(block->body, "first"));
+    CHECK(header.crc32 == Json_Number(block->body, "crc32"));
+    CHECK(header.crc32 == ~Crc32(0xFFFFFFFFUL, block->binary.data() + sizeof(header),
+                                 block->binary.size() - sizeof(header)));
+    for (uint8_t i = 0; i < header.records; i++) {
+      SampleRecord rec;
+      memcpy(&rec, block->binary.data() + sizeof(header) + i * sizeof(SampleRecord), sizeof(rec));
+      if (i == 0) {
+        CHECK(rec.time == header.firstTime);
+      }
+      if (lastTime != 0) {
+        CHECK_NEAR((double)rec.time - lastTime, 60, 5);
+      }
+      lastTime = rec.time;
+      CHECK(rec.current[0] >= 150 && rec.current[0] <= 210);
+      CHECK(rec.temperature[0] == 2345);
+      records++;
+    }
+  }
+  CHECK(records >= 38 && records <= 41);
+
+  // The same records as JSON notes would have cost more bytes and a
+  // transaction each
+  CHECK(Sim_Printed("Binary block transactions: ") == 3);
+  CHECK(Sim_Printed("Binary block bytes: ") < Sim_Printed("JSON notes for the same records, bytes: ") / 2);
+  CHECK(Sim_Printed("JSON notes for the same records, transactions: ") == BINARY_BLOCK_RECORDS);
+}
+
+static void Regular_Notes_Unchanged()
+{
+  // Outside a burst nothing goes through the binary buffer
+  Sim_Run(Sim_True_S() + 3 * 3600);
+  CHECK(Sim_Notes("burst.qo").empty());
+  CHECK(Sim_Requests("card.binary.put") == 0);
+  CHECK(Sim_Notes("data.qo").size() == Sim_Cycle_Rows().size());
+}
+
+int main()
+{
+  Test_Run("burst records upload as binary blocks", Burst_Blocks);
+  Test_Run("regular notes stay JSON", Regular_Notes_Unchanged);
+  return Test_Result();
+}
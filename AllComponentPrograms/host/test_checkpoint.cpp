@@ -0,0 +1,149 @@
+// Checkpointed cycles: reset the board at every phase of a cycle, restart
+// it with only the retained checkpoint surviving, and check that the cycle
+// carries on from where it stopped instead of starting over or being lost
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+// What survives a reset: retained RAM, and the time on the Notecard
+struct ResetState {
+  Checkpoint checkpoint;
+  double resetS;
+};
+
+static int resetPipe = -1;
+static uint8_t resetAtPhase;
+
+// Readings before and after the reset differ, so the note shows which
+// steps were carried over and which were run again
+static void Readings_Before()
+{
+  simWorld.currentMa = [](int, double) { return 100.0; };
+  simWorld.temperatureC = [](int, double) { return 20.0; };
+  simWorld.pm25 = [](int, double) { return 10.0; };
+}
+
+static void Readings_After()
+{
+  simWorld.currentMa = [](int, double) { return 300.0; };
+  simWorld.temperatureC = [](int, double) { return 30.0; };
+  simWorld.pm25 = [](int, double) { return 40.0; };
+}
+
+static void Reset_Here()
+{
+  // Called before each I2C transfer and Notecard request, so the step after
+  // the checkpoint has just started when the board goes down
+  if (checkpoint.magic != CHECKPOINT_MAGIC || checkpoint.phase != resetAtPhase) {
+    return;
+  }
+  if (resetAtPhase == CHECKPOINT_NONE && Sim_Notes("data.qo").empty()) {
+    return;  // Not finished yet, only never started
+  }
+  ResetState state = { checkpoint, Sim_True_S() };
+  if (write(resetPipe, &state, sizeof(state)) != sizeof(state)) {
+    _exit(3);
+  }
+  _exit(Sim_Notes("data.qo").size() == (resetAtPhase == CHECKPOINT_NONE ? 1 : 0) ? 0 : 1);
+}
+
+// The boot cycle's data note as an uninterrupted run sends it
+static std::string Reference_Body()
+{
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return "";
+  }
+  ForkResult result = Test_Fork([fds]() {
+    Readings_Before();
+    while (Sim_Notes("data.qo").empty()) {
+      Sim_Run(Sim_True_S() + 60);
+    }
+    const std::string &body = Sim_Notes("data.qo")[0]->body;
+    if (write(fds[1], body.data(), body.size()) != (ssize_t)body.size()) {
+      _exit(3);
+    }
+  });
+  close(fds[1]);
+  std::string body;
+  char buffer[4096];
+  ssize_t n;
+  while (result.passed && (n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+    body.append(buffer, n);
+  }
+  close(fds[0]);
+  return body;
+}
+
+static void Reset_At(uint8_t phase)
+{
+  // Run until the board resets in the chosen phase of the boot cycle
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  resetPipe = fds[1];
+  resetAtPhase = phase;
+  ForkResult interrupted = Test_Fork([]() {
+    Readings_Before();
+    simWorld.onActivity = Reset_Here;
+    Sim_Run(Sim_True_S() + 900);
+    _exit(4);  // Never reached the phase
+  });
+  close(fds[1]);
+  ResetState state;
+  CHECK(read(fds[0], &state, sizeof(state)) == sizeof(state));
+  close(fds[0]);
+  CHECK(interrupted.passed);  // No data note before the reset, one after it
+
+  // Power back up with the retained RAM and the Notecard's clock where the
+  // reset left them; everything else starts from scratch
+  simWorld.epochStart = (uint32_t)state.resetS;
+  checkpoint = state.checkpoint;
+  Readings_After();
+  Sim_Run(state.resetS + 60);
+  while (Sim_Notes("data.qo").empty() && Sim_True_S() < state.resetS + 900) {
+    Sim_Run(Sim_True_S() + 60);
+  }
+
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(!notes.empty());
+  if (notes.empty()) {
+    return;
+  }
+  const std::string &body = notes[0]->body;
+  std::string resumed = "Resuming cycle after checkpoint phase " + std::to_string(phase);
+  CHECK((simSerialOut.find(resumed) != std::string::npos) == (phase != CHECKPOINT_NONE));
+  if (phase == CHECKPOINT_NONE) {
+    // A finished cycle is not sent again; the next one measures afresh
+    CHECK_NEAR(Json_Number(body, "current"), 300, 2);
+    return;
+  }
+  CHECK_NEAR(Json_Number(body, "current"), phase >= CHECKPOINT_INA260 ? 100 : 300, 2);
+  CHECK_NEAR(Json_Number(body, "pm25_standard"), phase >= CHECKPOINT_PM25AQI ? 10 : 40, 0.5);
+  CHECK_NEAR(Json_Number(body, "temperature"), phase >= CHECKPOINT_AHTX0 ? 20 : 30, 0.1);
+  if (phase == CHECKPOINT_LOCATION) {
+    CHECK(body == Reference_Body());  // Time and place included
+  }
+}
+
+static void Corrupt_Checkpoint()
+{
+  // Garbage in retained RAM after a power cycle is not resumed
+  memset(&checkpoint, 0xA5, sizeof(checkpoint));
+  checkpoint.magic = CHECKPOINT_MAGIC;
+  checkpoint.phase = CHECKPOINT_AHTX0;
+  Sim_Run(Sim_True_S() + 300);
+  CHECK(simSerialOut.find("Resuming cycle") == std::string::npos);
+  CHECK(!Sim_Notes("data.qo").empty());
+}
+
+int main()
+{
+  Test_Run("reset after the INA260 reads", []() { Reset_At(CHECKPOINT_INA260); });
+  Test_Run("reset after the PM2.5 reads", []() { Reset_At(CHECKPOINT_PM25AQI); });
+  Test_Run("reset after the AHTX0 reads", []() { Reset_At(CHECKPOINT_AHTX0); });
+  Test_Run("reset after the location search", []() { Reset_At(CHECKPOINT_LOCATION); });
+  Test_Run("reset after the note was sent", []() { Reset_At(CHECKPOINT_NONE); });
+  Test_Run("corrupt checkpoint is ignored", Corrupt_Checkpoint);
+  return Test_Result();
+}
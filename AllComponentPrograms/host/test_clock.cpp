@@ -0,0 +1,64 @@
+// Disciplined clock: cycles stay on the 15-minute marks across millis()
+// drift, the time error stays within the bound the sketch computes, and
+// card.time is only asked for when that bound runs out
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static const double RUN_DAYS = 3;
+
+static std::vector<double> markOffsetsS;  // Start of each cycle relative to its mark
+static size_t serialSeen = 0;
+static double worstErrorRatio = 0;  // Actual error over the sketch's bound
+
+static void Watch_Clock()
+{
+  // A cycle starts reading the INA260 right after it prints this
+  size_t at = simSerialOut.find("Reached the sampling mark", serialSeen);
+  if (at != std::string::npos) {
+    serialSeen = at + 1;
+    double sinceMarkS = fmod(Sim_True_S(), 900);
+    markOffsetsS.push_back(sinceMarkS > 450 ? sinceMarkS - 900 : sinceMarkS);
+  }
+  if (clockSynced) {
+    unsigned long errorMs;
+    double offsetMs = (double)Clock_Now_Ms(&errorMs) - Sim_True_S() * 1000;
+    worstErrorRatio = fmax(worstErrorRatio, fabs(offsetMs) / errorMs);
+  }
+}
+
+static void Drift(double ppm)
+{
+  simWorld.driftPpm = ppm;
+  simWorld.onActivity = Watch_Clock;
+  Sim_Run(Sim_True_S() + RUN_DAYS * 86400);
+
+  // The boot cycle starts straight away; every later one on its mark
+  CHECK(markOffsetsS.size() >= RUN_DAYS * 96);
+  for (size_t i = 1; i < markOffsetsS.size(); i++) {
+    CHECK(fabs(markOffsetsS[i]) < CLOCK_MAX_ERROR_MS / 1000.0);
+  }
+  CHECK(worstErrorRatio <= 1);
+
+  // The drift is measured, and that stretches the syncs out to hours apart
+  size_t at = simSerialOut.rfind("Clock synced, drift (ppm): ");
+  CHECK(at != std::string::npos);
+  if (at != std::string::npos) {
+    CHECK_NEAR(strtod(simSerialOut.c_str() + at + 27, NULL), ppm, 2);
+  }
+  size_t syncs = 0;
+  for (size_t p = 0; (p = simSerialOut.find("Clock synced", p)) != std::string::npos; p++) {
+    syncs++;
+  }
+  CHECK(syncs <= RUN_DAYS * 24 / 4);
+  CHECK(Sim_Requests("card.time") < markOffsetsS.size() / 4);  // Was one or more per cycle
+}
+
+int main()
+{
+  Test_Run("no drift", []() { Drift(0); });
+  Test_Run("millis() 150 ppm fast", []() { Drift(150); });
+  Test_Run("millis() 150 ppm slow", []() { Drift(-150); });
+  return Test_Result();
+}
@@ -0,0 +1,127 @@
+// Inbound commands through commands.qi: applied as soon as the sync that
+// brings them in completes, carried out on the burst cadence, acknowledged
+// in commands_ack.qo, and the fans put back to sleep when a burst ends
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static bool Has(const SimNote *note, const char *text)
+{
+  return note->body.find(text) != std::string::npos;
+}
+
+// Fan state every 10 s, so a fan left running in the middle of a wait shows
+struct FanSample {
+  double trueS;
+  bool on;
+};
+static std::vector<FanSample> fanSamples;
+
+static void Sample_Fans()
+{
+  fanSamples.push_back({ Sim_True_S(), Sim_Fan_On() });
+  Sim_At_Us(Sim_Local_Us() + 10000000, Sample_Fans);
+}
+
+// True if the fans ran after fromS other than to warm up for a 15-minute mark
+static bool Fans_On_Between_Marks(double fromS)
+{
+  for (const FanSample &sample : fanSamples) {
+    double toMarkS = 900 - fmod(sample.trueS, 900);
+    if (sample.trueS > fromS && sample.on && toMarkS > PM25AQI_WARMUP_S + 10 && fmod(sample.trueS, 900) > 120) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Burst_Runs_And_Ends()
+{
+  Sim_Command_Queue("{\"cmd\":\"burst\",\"minutes\":30,\"cadence_s\":60}");
+  Sample_Fans();
+  double startS = Sim_True_S();
+  Sim_Run(startS + 3 * 3600);
+
+  // The boot note's sync brings the command in, and it is applied once
+  // that sync is seen to complete, not at the next mark
+  std::vector<const SimNote *> data = Sim_Notes("data.qo");
+  std::vector<const SimNote *> acks = Sim_Notes("commands_ack.qo");
+  CHECK(acks.size() == 1);
+  if (acks.empty() || data.empty()) {
+    return;
+  }
+  double ackS = acks[0]->trueS;
+  CHECK(ackS > data[0]->trueS + simWorld.syncS);
+  CHECK(ackS < data[0]->trueS + simWorld.syncS + 2 * SYNC_CHECK_MS / 1000.0 + 5);
+  CHECK(Has(acks[0], "\"cmd\":\"burst\"") && Has(acks[0], "\"status\":\"ok\""));
+  CHECK_NEAR(Json_Number(acks[0]->body, "cadence_s"), 60, 0);
+  double burstUntilS = Json_Number(acks[0]->body, "burst_until");
+  CHECK_NEAR(burstUntilS, ackS + 30 * 60, 2);
+
+  // A note a minute during the burst, every 15 minutes after it. The first
+  // burst note comes on the next minute mark after the ack.
+  size_t inBurst = 0;
+  for (size_t i = 1; i < data.size(); i++) {
+    double gapS = data[i]->trueS - data[i - 1]->trueS;
+    if (data[i - 1]->trueS > ackS && data[i]->trueS < burstUntilS) {
+      CHECK_NEAR(gapS, 60, 5);
+      inBurst++;
+    } else if (data[i - 1]->trueS > burstUntilS + 900) {
+      CHECK_NEAR(gapS, 900, 5);
+    }
+  }
+  CHECK(inBurst >= 28);
+
+  // The fans ran through the burst, then only for the warm-up and reads
+  // around each mark
+  CHECK(!Fans_On_Between_Marks(burstUntilS + 60));
+}
+
+static void Normal_Ends_Burst()
+{
+  Sim_Command_Queue("{\"cmd\":\"burst\",\"minutes\":120,\"cadence_s\":60}");
+  Sample_Fans();
+  Sim_Run(Sim_True_S() + 1600);
+  CHECK(Sim_Fan_On());
+  size_t notes = Sim_Notes("data.qo").size();
+  CHECK(notes >= 20);
+
+  // "normal" arrives with the next sync, one burst note later and well
+  // before the next 15-minute mark
+  Sim_Command_Queue("{\"cmd\":\"normal\"}");
+  double sentS = Sim_True_S();
+  Sim_Run(sentS + 1800);
+  std::vector<const SimNote *> acks = Sim_Notes("commands_ack.qo");
+  CHECK(acks.size() == 2);
+  if (acks.size() == 2) {
+    CHECK(Has(acks[1], "\"cmd\":\"normal\"") && Has(acks[1], "\"status\":\"ok\""));
+    CHECK(!Has(acks[1], "burst_until"));
+    CHECK(acks[1]->trueS < sentS + 120);
+  }
+  CHECK(!Fans_On_Between_Marks(sentS + 120));  // Asleep until the next warm-up
+  CHECK(Sim_Notes("data.qo").size() <= notes + 4);
+}
+
+static void Bad_Commands_Answered()
+{
+  Sim_Command_Queue("{\"cmd\":\"burst\",\"minutes\":30,\"cadence_s\":5}");
+  Sim_Command_Queue("{\"cmd\":\"reboot\"}");
+  Sim_Run(Sim_True_S() + 1800);
+  std::vector<const SimNote *> acks = Sim_Notes("commands_ack.qo");
+  CHECK(acks.size() == 2);
+  if (acks.size() == 2) {
+    CHECK(Has(acks[0], "\"status\":\"rejected\""));
+    CHECK(Has(acks[1], "\"cmd\":\"reboot\"") && Has(acks[1], "\"status\":\"unknown\""));
+  }
+  CHECK(burstUntilMs == 0);
+  CHECK(Sim_Notes("data.qo").size() <= 4);  // Still on the 15-minute marks
+}
+
+int main()
+{
+  Test_Run("burst applied after the sync, fans sleep after it", Burst_Runs_And_Ends);
+  Test_Run("normal ends a burst early", Normal_Ends_Burst);
+  Test_Run("bad and unknown commands are answered", Bad_Commands_Answered);
+  return Test_Result();
+}
@@ -0,0 +1,85 @@
+// Runtime configuration from Notecard environment variables: parsing,
+// change detection, and settings that take effect after the next sync
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static unsigned long Parse(const char *text, unsigned long minValue, unsigned long maxValue, bool hex)
+{
+  J *body = JCreateObject();
+  JAddStringToObject(body, "v", text);
+  unsigned long value = Config_Value(body, "v", 77, minValue, maxValue, hex);
+  JDelete(body);
+  return value;
+}
+
+static void Values_Parse()
+{
+  // Decimal even with a leading zero; 77 is the setting kept on a bad value
+  CHECK(Parse("900", 0, 3600, false) == 900);
+  CHECK(Parse("0900", 0, 3600, false) == 900);
+  CHECK(Parse("010", 0, 3600, false) == 10);
+  CHECK(Parse("0", 0, 3600, false) == 0);
+  CHECK(Parse("", 0, 3600, false) == 77);
+  CHECK(Parse("12abc", 0, 3600, false) == 77);
+  CHECK(Parse("-5", 0, 3600, false) == 77);
+  CHECK(Parse(" 5", 0, 3600, false) == 77);
+  CHECK(Parse("4000", 0, 3600, false) == 77);
+  CHECK(Parse("0x0F", 0, 3600, false) == 77);
+
+  // Hex only where it is allowed
+  CHECK(Parse("0x0F", 1, 0xFF, true) == 0x0F);
+  CHECK(Parse("0XfF", 1, 0xFF, true) == 0xFF);
+  CHECK(Parse("15", 1, 0xFF, true) == 15);
+  CHECK(Parse("0x", 1, 0xFF, true) == 77);
+  CHECK(Parse("0x100", 1, 0xFF, true) == 77);
+}
+
+static void Interval_Changes_After_Sync()
+{
+  Sim_Env_Set("sample_interval_s", "300");
+  Sim_Env_Set("gps_timeout_s", "0900");
+  double startS = Sim_True_S();
+  Sim_Run(startS + 3 * 3600);
+
+  // The boot note's sync brings the new interval in; from the next mark on
+  // the notes come every 5 minutes
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() >= 3 * 12);
+  for (size_t i = 3; i < notes.size(); i++) {
+    CHECK_NEAR(notes[i]->trueS - notes[i - 1]->trueS, 300, 10);
+  }
+  CHECK(config.intervalMs == 300000);
+  CHECK(config.gpsTimeoutS == 900);
+
+  // env.modified is polled after every sync, the variables fetched once
+  CHECK(Sim_Requests("env.modified") >= notes.size() / 2);
+  CHECK(Sim_Requests("env.get") <= 2);
+}
+
+static void Port_Mask()
+{
+  // A hex mask keeping every sensor is taken; one that drops the PM2.5
+  // sensor on port 2 is refused and the readings carry on
+  Sim_Env_Set("mux_ports", "0x0F");
+  Sim_Run(Sim_True_S() + 1800);
+  CHECK(config.muxPortMask == 0x0F);
+  Sim_Env_Set("mux_ports", "0x03");
+  Sim_Run(Sim_True_S() + 3600);
+  CHECK(config.muxPortMask == 0x0F);
+  CHECK(simSerialOut.find("mux_ports leaves a sensor type out") != std::string::npos);
+  CHECK(ahtCount == 1 && aqiCount == 1 && ina260Count == 1);
+  const SimNote *last = Sim_Notes("data.qo").back();
+  CHECK_NEAR(Json_Number(last->body, "pm25_standard"), 12, 0.5);
+  CHECK_NEAR(Json_Number(last->body, "current"), 182, 2);
+  CHECK(!Sim_Fan_On());  // Woken for the probe, asleep again after it
+}
+
+int main()
+{
+  Test_Run("values parse as decimal, hex only for masks", Values_Parse);
+  Test_Run("a new interval applies after the sync", Interval_Changes_After_Sync);
+  Test_Run("port mask changes, bad masks refused", Port_Mask);
+  return Test_Result();
+}
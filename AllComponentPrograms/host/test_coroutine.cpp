@@ -0,0 +1,55 @@
+// COROUTINE_READS: the executor interleaves the reads on the virtual clock,
+// and a build whose frames outgrow the arena stops at boot
+#define DEBUG 1
+#define COROUTINE_READS 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Reads_Interleave()
+{
+  simWorld.currentMa = [](int, double) { return 200.0; };
+  simWorld.temperatureC = [](int, double) { return 25.0; };
+  simWorld.pm25 = [](int, double) { return 20.0; };
+  Sim_Run(Sim_True_S() + 3 * 3600);
+
+  // The boot cycle runs the PM warm-up and the GPS search side by side, so
+  // it takes about the longer of the two, not their sum as when blocking
+  double firstMs = Sim_Printed("Time to first reading (ms): ");
+  CHECK(firstMs >= simWorld.gpsFixS * 1000.0);
+  CHECK(firstMs < (PM25AQI_WARMUP_S + simWorld.gpsFixS) * 1000.0);
+
+  // Every task still finishes: each record carries all three sensors
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() == Sim_Cycle_Rows().size());
+  CHECK(notes.size() >= 12);
+  for (const SimNote *note : notes) {
+    CHECK_NEAR(Json_Number(note->body, "current"), 200, 2);
+    CHECK_NEAR(Json_Number(note->body, "temperature"), 25, 0.1);
+    CHECK_NEAR(Json_Number(note->body, "pm25_standard"), 20, 0.5);
+  }
+  CHECK(!Sim_Fan_On());
+  for (bool used : coroutineSlotUsed) {
+    CHECK(!used);  // No frame leaked
+  }
+}
+
+static void Arena_Too_Small()
+{
+  // With one slot taken the four frames cannot all be placed, as when a
+  // frame outgrows COROUTINE_FRAME_BYTES
+  ForkResult result = Test_Fork([]() {
+    coroutineSlotUsed[0] = true;
+    Sim_Run(Sim_True_S() + 600);
+  }, 2);
+  CHECK(result.timedOut);
+  CHECK(result.serial.find("Coroutine frames do not fit the arena") != std::string::npos);
+  CHECK(result.serial.find("Time to first reading") == std::string::npos);
+}
+
+int main()
+{
+  Test_Run("reads interleave on the executor", Reads_Interleave);
+  Test_Run("frames that do not fit stop the boot", Arena_Too_Small);
+  return Test_Result();
+}
@@ -0,0 +1,60 @@
+// Deadband reporting: every cycle reports by default; with max_silence_s
+// set, cycles inside every deadband are skipped, a step past one is sent at
+// once, and a note still goes out when the silence interval runs out
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Every_Cycle_By_Default()
+{
+  Sim_Run(Sim_True_S() + 4 * 3600);
+  std::vector<CycleRow> rows = Sim_Cycle_Rows();
+  CHECK(Sim_Notes("data.qo").size() == rows.size());
+  CHECK(!rows.empty() && rows.back().skipped == 0);
+}
+
+static void Silence_And_Steps()
+{
+  // Steady readings, a 0.1 C wobble (inside the 0.20 C deadband) after two
+  // hours and a 1 C step after four
+  double startS = Sim_True_S();
+  simWorld.temperatureC = [startS](int, double t) {
+    return 23.0 + (t > startS + 2 * 3600 ? 0.1 : 0) + (t > startS + 4 * 3600 ? 1.0 : 0);
+  };
+  Sim_Env_Set("max_silence_s", "3600");
+  Sim_Run(startS + 6 * 3600);
+
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  std::vector<CycleRow> rows = Sim_Cycle_Rows();
+  CHECK(!rows.empty() && rows.back().skipped >= rows.size() / 2);
+  CHECK(notes.size() + rows.back().skipped == rows.size());
+
+  // No gap longer than the silence interval and a cycle
+  for (size_t i = 1; i < notes.size(); i++) {
+    CHECK(notes[i]->trueS - notes[i - 1]->trueS <= 3600 + 900 + 60);
+  }
+
+  // The wobble is not reported on its own, so only the two heartbeats fall
+  // between it and the step; the step is sent on the next cycle
+  size_t quiet = 0;
+  bool stepSent = false;
+  for (const SimNote *note : notes) {
+    double sinceStartS = note->trueS - startS;
+    if (sinceStartS > 2 * 3600 + 120 && sinceStartS < 4 * 3600) {
+      quiet++;
+    }
+    if (sinceStartS > 4 * 3600 && sinceStartS < 4 * 3600 + 900 + 120) {
+      stepSent = fabs(Json_Number(note->body, "temperature") - 24.1) < 0.01;
+    }
+  }
+  CHECK(quiet <= 2);
+  CHECK(stepSent);
+}
+
+int main()
+{
+  Test_Run("every cycle reports by default", Every_Cycle_By_Default);
+  Test_Run("silence interval, deadbands and steps", Silence_And_Steps);
+  return Test_Result();
+}
@@ -0,0 +1,126 @@
+// DEBUG_DEFERRED: debug output is queued raw and sent as binary records
+// while idle, and host/log_decode.h turns it back into text. Literals go out
+// as format IDs, every other string is copied, and the ring keeps up with a
+// high-rate build's output.
+#define DEBUG 1
+#define DEBUG_DEFERRED 1
+#define HIGH_RATE_ACQUISITION 1
+#define PROFILE 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static size_t Count(const std::string &haystack, const std::string &needle)
+{
+  size_t n = 0;
+  for (size_t at = haystack.find(needle); at != std::string::npos; at = haystack.find(needle, at + 1)) {
+    n++;
+  }
+  return n;
+}
+
+static void Entries()
+{
+  // Nothing is sent until the flush
+  char name[16] = "before";
+  debugPrint(name);
+  strcpy(name, "after");
+  debugPrint(" n="); debugPrint(42L);
+  debugPrint(" x="); debugPrint(-3.5);
+  debugPrint(" m="); debugPrint(-7);
+  debugPrintln(" end");
+  CHECK(simSerialOut.empty());
+  CHECK(logRing[0].type == LOG_TEXT);  // An array, but not a literal
+  CHECK(logRing[1].type == LOG_LITERAL);
+  CHECK(logRing[2].type == LOG_LONG);
+  CHECK(logRing[4].type == LOG_DOUBLE);
+  debugDrain();
+  CHECK(Sim_Serial_Text() == "before n=42 x=-3.50 m=-7 end\r\n");
+
+  // On the wire: one frame per entry plus one per literal defined, and the
+  // numbers unformatted
+  CHECK(Count(simSerialOut, std::string(1, '\0')) == 8 + 4);
+  CHECK(Count(simSerialOut, "-3.50") == 0);
+
+  // Long strings are truncated, a full ring counts what it drops
+  simSerialOut.clear();
+  std::string longText(LOG_TEXT_BYTES + 10, 'a');
+  debugPrintln(longText.c_str());
+  for (int i = 0; i < LOG_ENTRIES + 10; i++) {
+    debugPrint("x");
+  }
+  debugDrain();
+  std::string text = Sim_Serial_Text();
+  std::string dropped = "[debug log dropped 12 entries]\r\n";
+  CHECK(text.compare(0, dropped.size(), dropped) == 0);
+  CHECK(text.compare(dropped.size(), LOG_TEXT_BYTES + 1, longText.substr(0, LOG_TEXT_BYTES - 1) + "\r\n") == 0);
+
+  // Once every format ID is taken, new literals are sent as text
+  simSerialOut.clear();
+  logFormatCount = LOG_FORMATS;
+  debugPrintln("no ID left");
+  debugDrain();
+  CHECK(Sim_Serial_Text() == "no ID left\r\n");
+  CHECK(Count(simSerialOut, std::string(1, '\0')) == 1);
+}
+
+static void Decoder_Joins_Late()
+{
+  // A literal is defined once, whichever entry it is in
+  for (long i = 1; i <= 2; i++) {
+    debugPrint("first "); debugPrintln(i);
+  }
+  debugDrain();
+  CHECK(Count(simSerialOut, "first ") == 1);
+
+  // A decoder that starts mid-frame skips to the next one, and shows the
+  // literals defined before it joined by their ID
+  LogDecoder decoder;
+  std::string text = decoder.Add(simSerialOut.substr(3));
+  CHECK(decoder.badFrames == 1);
+  CHECK(text == "[format 0]1\r\n[format 0]2\r\n");
+
+  // Frames split across reads decode the same
+  LogDecoder whole, split;
+  std::string expected = whole.Add(simSerialOut);
+  std::string joined;
+  for (char c : simSerialOut) {
+    joined += split.Add(std::string(1, c));
+  }
+  CHECK(expected == "first 1\r\nfirst 2\r\n");
+  CHECK(joined == expected);
+}
+
+static void Keeps_Up()
+{
+  // A day of high-rate cycles and a health report, whose per-request rows
+  // alone are more than the ring holds
+  Sim_Run(Sim_True_S() + 86400 + 3600);
+  debugDrain();
+  std::string text = Sim_Serial_Text();
+  CHECK(text.find("[debug log dropped") == std::string::npos);
+  std::vector<CycleRow> rows = Sim_Cycle_Rows();
+  CHECK(rows.size() >= PROFILE_REPORT_CYCLES);
+  CHECK(Sim_Notes("data.qo").size() == rows.size());
+  CHECK(Sim_Printed("High-rate INA260 samples: ") > 0);
+  CHECK(Sim_Notes("health.qo").size() == 1);
+  CHECK(text.find("\nnote.add: n=") != std::string::npos);
+  CHECK(text.find("\ncard.location.mode: n=") != std::string::npos);
+  CHECK(text.find("\nhub.sync.status: n=") != std::string::npos);
+  CHECK(text.find("\n: n=") == std::string::npos);
+
+  // note-c's request tracing stays off the UART, and every literal fitted
+  // in the format table
+  CHECK(text.find("{\"req\":") == std::string::npos);
+  CHECK(logFormatCount < LOG_FORMATS);
+  CHECK(Count(simSerialOut, "Reached the sampling mark") == 1);
+  CHECK(Count(text, "Reached the sampling mark") == rows.size());
+}
+
+int main()
+{
+  Test_Run("entries copy strings and keep literals", Entries);
+  Test_Run("a late decoder recovers", Decoder_Joins_Late);
+  Test_Run("the log keeps up with high-rate output", Keeps_Up);
+  return Test_Result();
+}
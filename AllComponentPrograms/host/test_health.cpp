@@ -0,0 +1,107 @@
+// PROFILE: health.qo carries each phase's histogram, and host/health.h
+// decodes it back into percentiles and the ranges they truly lie in
+#define DEBUG 1
+#define PROFILE 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+#include "health.h"
+
+static const PhaseHealth *Find_Phase(const Health &health, const char *name)
+{
+  for (const PhaseHealth &phase : health.phases) {
+    if (phase.name == name) {
+      return &phase;
+    }
+  }
+  return NULL;
+}
+
+static void Known_Histogram()
+{
+  // Boot, then replace what the first cycle recorded with a known spread:
+  // 50 x 100 us, 40 x 1000 us and 10 x 20000 us
+  Sim_Run(Sim_True_S() + 60);
+  memset(phaseHistogram, 0, sizeof(phaseHistogram));
+  memset(phaseMaxUs, 0, sizeof(phaseMaxUs));
+  for (int i = 0; i < 50; i++) {
+    Profile_Record(PHASE_SEND, 100);
+  }
+  for (int i = 0; i < 40; i++) {
+    Profile_Record(PHASE_SEND, 1000);
+  }
+  for (int i = 0; i < 10; i++) {
+    Profile_Record(PHASE_SEND, 20000);
+  }
+  Send_Health();
+
+  std::vector<const SimNote *> notes = Sim_Notes("health.qo");
+  CHECK(notes.size() == 1);
+  if (notes.empty()) {
+    return;
+  }
+  Health health;
+  CHECK(Health_Decode(notes.back()->body, &health));
+  CHECK(health.phases.size() == PHASE_COUNT);
+  const PhaseHealth *send = Find_Phase(health, "send");
+  CHECK(send != NULL);
+  if (send == NULL) {
+    return;
+  }
+
+  // 100 us is in bucket 6, [64, 128); 1000 us in bucket 9; 20000 us in 14
+  CHECK(send->lo == 6);
+  CHECK(send->hist.size() == 9 && send->hist[0] == 50 && send->hist[3] == 40 && send->hist[8] == 10);
+
+  // Reported: the upper bucket edges, capped at the maximum
+  CHECK_NEAR(send->p50Ms, 0.127, 1e-9);
+  CHECK_NEAR(send->p90Ms, 1.023, 1e-9);
+  CHECK_NEAR(send->p99Ms, 20.0, 1e-9);
+  CHECK_NEAR(send->maxMs, 20.0, 1e-9);
+
+  // Decoded: each range holds the true percentile and the reported one
+  double lowMs = 0, highMs = 0;
+  CHECK(Health_Bound(*send, 50, &lowMs, &highMs));
+  CHECK_NEAR(lowMs, 0.064, 1e-9);
+  CHECK_NEAR(highMs, 0.127, 1e-9);
+  CHECK(Health_Bound(*send, 90, &lowMs, &highMs));
+  CHECK_NEAR(lowMs, 0.512, 1e-9);
+  CHECK_NEAR(highMs, 1.023, 1e-9);
+  CHECK(Health_Bound(*send, 99, &lowMs, &highMs));
+  CHECK_NEAR(lowMs, 16.384, 1e-9);
+  CHECK_NEAR(highMs, 20.0, 1e-9);
+
+  // A phase that recorded nothing has no histogram to bound
+  const PhaseHealth *jitter = Find_Phase(health, "jitter");
+  CHECK(jitter != NULL && jitter->lo < 0 && !Health_Bound(*jitter, 50, &lowMs, &highMs));
+}
+
+static void Daily_Report()
+{
+  // A day's report decodes with every percentile inside its range
+  Sim_Run(Sim_True_S() + 86400 + 1800);
+  std::vector<const SimNote *> notes = Sim_Notes("health.qo");
+  CHECK(notes.size() == 1);
+  if (notes.empty()) {
+    return;
+  }
+  Health health;
+  CHECK(Health_Decode(notes[0]->body, &health));
+  CHECK(health.cycles == PROFILE_REPORT_CYCLES);
+  for (const PhaseHealth &phase : health.phases) {
+    double lowMs = 0, highMs = 0;
+    if (Health_Bound(phase, 90, &lowMs, &highMs)) {
+      CHECK(lowMs <= phase.p90Ms + 1e-9 && phase.p90Ms <= highMs + 1e-9);
+      CHECK(highMs <= 2 * lowMs + 0.001);
+    }
+  }
+  const PhaseHealth *ina = Find_Phase(health, "ina260");
+  CHECK(ina != NULL && ina->lo >= 0);
+}
+
+int main()
+{
+  Test_Run("a known histogram decodes", Known_Histogram);
+  Test_Run("a day's health note decodes", Daily_Report);
+  return Test_Result();
+}
@@ -0,0 +1,108 @@
+// HIGH_RATE_ACQUISITION: the CIC decimator on its own, and the INA260 and
+// PM values it produces ending up in the note at the right scale
+#define DEBUG 1
+#define HIGH_RATE_ACQUISITION 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Decimator_Settles()
+{
+  // A constant comes out exactly once the start-up outputs are dropped
+  Decimator d;
+  Decimator_Reset(&d);
+  for (int i = 0; i < 40 * DECIMATION_FACTOR; i++) {
+    Decimator_Add(&d, 1234);
+  }
+  CHECK(d.outputs == 40);
+  CHECK_NEAR(Decimator_Mean(&d), 1234, 1e-3);
+
+  // Noise at the input rate averages out; negative values survive the
+  // unsigned wrap-around
+  Decimator_Reset(&d);
+  for (int i = 0; i < 40 * DECIMATION_FACTOR; i++) {
+    Decimator_Add(&d, (i % 2) ? -500 - 300 : -500 + 300);
+  }
+  CHECK_NEAR(Decimator_Mean(&d), -500, 1e-3);
+
+  // Too few inputs to settle: the raw mean
+  Decimator_Reset(&d);
+  for (int i = 0; i < 10; i++) {
+    Decimator_Add(&d, 100 + i);
+  }
+  CHECK(d.outputs == 0);
+  CHECK_NEAR(Decimator_Mean(&d), 104.5, 1e-3);
+}
+
+static void Constant_Readings()
+{
+  simWorld.currentMa = [](int, double) { return 200.0; };
+  simWorld.voltageMv = [](int, double) { return 5000.0; };
+  simWorld.temperatureC = [](int, double) { return 25.0; };
+  simWorld.humidityRh = [](int, double) { return 40.0; };
+  simWorld.pm25 = [](int, double) { return 123.0; };
+  Sim_Run(Sim_True_S() + 3600);
+
+  // Same values as the 2 Hz path would report; PM is scaled once, not twice
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() >= 4);
+  for (const SimNote *note : notes) {
+    CHECK_NEAR(Json_Number(note->body, "current"), 200, 1);
+    CHECK_NEAR(Json_Number(note->body, "voltage"), 5000, 2);
+    CHECK_NEAR(Json_Number(note->body, "power"), 1000, 2);
+    CHECK_NEAR(Json_Number(note->body, "pm25_standard"), 123, 0.5);
+    CHECK_NEAR(Json_Number(note->body, "pm25_env"), 123, 0.5);
+    CHECK_NEAR(Json_Number(note->body, "pm10_standard"), 0.8 * 123, 0.5);
+    CHECK_NEAR(Json_Number(note->body, "pm25_env_rh"), PM_Humidity_Correct(123, 40), 0.5);
+  }
+
+  // Far more INA260 samples than the ten a cycle used to take, enough for
+  // the CIC to settle
+  CHECK(Sim_Printed("High-rate INA260 samples: ") > 3 * DECIMATION_ORDER * DECIMATION_FACTOR);
+}
+
+static void Fast_Sine_Mean()
+{
+  // A 2 Hz ripple, which the 500 ms readings of the default build would
+  // alias to a fixed offset, averages out to its midpoint
+  simWorld.currentMa = [](int, double t) { return 200 + 50 * sin(2 * M_PI * t / 0.5); };
+  Sim_Run(Sim_True_S() + 1800);
+  for (const SimNote *note : Sim_Notes("data.qo")) {
+    CHECK_NEAR(Json_Number(note->body, "current"), 200, 5);
+  }
+}
+
+static void Gps_Timeout()
+{
+  // With no fix the location search runs its full 600 s while the INA260s
+  // are still read back to back: some 135,000 decimated outputs a cycle,
+  // more than a 16-bit count holds
+  simWorld.gpsFixS = 1e9;
+  simWorld.currentMa = [](int, double t) { return 200 + 50 * sin(2 * M_PI * t / 0.5); };
+  simWorld.voltageMv = [](int, double) { return 5000.0; };
+  Sim_Run(Sim_True_S() + 3600);
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() >= 3);
+  for (const SimNote *note : notes) {
+    CHECK_NEAR(Json_Number(note->body, "current"), 200, 1);
+    CHECK_NEAR(Json_Number(note->body, "voltage"), 5000, 2);
+    CHECK_NEAR(Json_Number(note->body, "power"), 1000, 5);
+  }
+
+  // The window's final count is printed after the provisional one
+  const char *label = "High-rate INA260 samples: ";
+  double mostSamples = 0;
+  for (size_t at = simSerialOut.find(label); at != std::string::npos; at = simSerialOut.find(label, at + 1)) {
+    mostSamples = fmax(mostSamples, strtod(simSerialOut.c_str() + at + strlen(label), NULL));
+  }
+  CHECK(mostSamples > 65536.0 * DECIMATION_FACTOR);
+}
+
+int main()
+{
+  Test_Run("decimator settles on the mean", Decimator_Settles);
+  Test_Run("constant readings come through at scale", Constant_Readings);
+  Test_Run("fast sine averages to its midpoint", Fast_Sine_Mean);
+  Test_Run("a GPS search that times out", Gps_Timeout);
+  return Test_Result();
+}
@@ -0,0 +1,66 @@
+// I2C accounting: the i2c_txn and i2c_bytes each cycle reports match what
+// the fake bus carried, and the mux is only written when the port changes.
+// INTERRUPT_CAPTURE adds the alert-driven INA260 reads to the count.
+#define DEBUG 1
+#define INTERRUPT_CAPTURE 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Counts_Match_Bus()
+{
+  // Boot first: the drivers' begin() and configuration traffic is not
+  // accounted, so compare from the first loop() on. Two INA260s and two
+  // AHTX0s make every read switch ports.
+  simWorld.ina260Ports = (1 << 0) | (1 << 3);
+  simWorld.ahtx0Ports = (1 << 1) | (1 << 4);
+  double startS = Sim_True_S();
+  Sim_Run(startS + 1);
+  size_t bootRows = Sim_Cycle_Rows().size();
+  unsigned long busTxn = simI2cTransactions, busBytes = simI2cBytes;
+  unsigned long sketchTxn = i2cTransactions, sketchBytes = i2cBytes;
+
+  Sim_Run(startS + 6 * 3600);
+  std::vector<CycleRow> rows = Sim_Cycle_Rows();
+  CHECK(rows.size() > bootRows + 20);
+  unsigned long txn = i2cTransactions - sketchTxn, bytes = i2cBytes - sketchBytes;
+  for (size_t i = bootRows; i < rows.size(); i++) {
+    txn += rows[i].i2cTxn;
+    bytes += rows[i].i2cBytes;
+  }
+  CHECK(txn > 0);
+  CHECK(txn == simI2cTransactions - busTxn);
+  CHECK(bytes == simI2cBytes - busBytes);
+}
+
+static void Mux_Written_On_Change()
+{
+  Sim_Run(Sim_True_S() + 1);
+
+  // Discovery leaves the last port scanned selected, and knows it
+  unsigned long busTxn = simI2cTransactions;
+  Mux_Select(muxPort);
+  CHECK(simI2cTransactions == busTxn);
+
+  // An INA260 sample is two repeated-start register reads once its port
+  // is selected, plus one mux write when it is not
+  Mux_Select(aqiPorts[0]);
+  float currentMa, voltageMv;
+  busTxn = simI2cTransactions;
+  unsigned long busBytes = simI2cBytes;
+  CHECK(INA260_Read(0, &currentMa, &voltageMv));
+  CHECK(simI2cTransactions - busTxn == 3);
+  CHECK(simI2cBytes - busBytes == 1 + 3 + 3);
+  busTxn = simI2cTransactions;
+  busBytes = simI2cBytes;
+  CHECK(INA260_Read(0, &currentMa, &voltageMv));
+  CHECK(simI2cTransactions - busTxn == 2);
+  CHECK(simI2cBytes - busBytes == 3 + 3);
+}
+
+int main()
+{
+  Test_Run("reported I2C traffic matches the bus", Counts_Match_Bus);
+  Test_Run("the mux is written only to change ports", Mux_Written_On_Change);
+  return Test_Result();
+}
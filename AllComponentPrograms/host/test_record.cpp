@@ -0,0 +1,84 @@
+// SampleRecord and the sample store: bytes per record packed, in the ring
+// and as the JSON data note it replaces, and records round-trip the ring.
+// BINARY_UPLOAD adds the bytes per record of a binary block.
+#define DEBUG 1
+#define BINARY_UPLOAD 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Record_Size()
+{
+  // No padding: the record is exactly its fields
+  size_t fields = sizeof(uint32_t) + 2 * sizeof(int32_t) +
+                  MAX_SENSOR_INSTANCES * (5 * sizeof(uint16_t) + PM_FIELDS * sizeof(uint16_t));
+  CHECK(sizeof(SampleRecord) == fields);
+  CHECK(sizeof(SampleRecord) == 80);  // Two instances per sensor type
+  CHECK(sizeof(SampleStore) <= SAMPLE_STORE_RECORDS * sizeof(SampleRecord) + 4);
+
+  Sim_Run(Sim_True_S() + 1);
+  CHECK(Sim_Printed("Sample record bytes: ") == sizeof(SampleRecord));
+  CHECK(Sim_Printed("Sample store bytes: ") == sizeof(SampleStore));
+}
+
+static void Store_Round_Trip()
+{
+  // More records than the ring holds: the newest come back unchanged
+  for (int n = 0; n < SAMPLE_STORE_RECORDS + 5; n++) {
+    SampleRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time = 1760000000 + 900 * n;
+    rec.lat = 4681810 + n;
+    rec.current[1] = -n;
+    rec.pm[1][PM_FIELDS - 1] = n;
+    Store_Push(&rec);
+  }
+  CHECK(sampleStore.count == SAMPLE_STORE_RECORDS);
+  for (int age = 0; age < SAMPLE_STORE_RECORDS; age++) {
+    int n = SAMPLE_STORE_RECORDS + 4 - age;
+    SampleRecord rec;
+    CHECK(Store_Get(age, &rec));
+    CHECK(rec.time == 1760000000UL + 900 * n && rec.lat == 4681810 + n);
+    CHECK(rec.current[1] == -n && rec.pm[1][PM_FIELDS - 1] == n);
+  }
+  SampleRecord rec;
+  CHECK(!Store_Get(SAMPLE_STORE_RECORDS, &rec));
+}
+
+static void Bytes_Per_Record()
+{
+  // A burst sends its records in binary blocks; the cycles around it send
+  // the JSON data notes the packed record replaces
+  Sim_Command_Queue("{\"cmd\":\"burst\",\"minutes\":20,\"cadence_s\":60}");
+  Sim_Run(Sim_True_S() + 3 * 3600);
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  std::vector<const SimNote *> blocks = Sim_Notes("burst.qo");
+  CHECK(notes.size() >= 10);
+  CHECK(!blocks.empty());
+  double jsonBytes = 0;
+  for (const SimNote *note : notes) {
+    jsonBytes += note->body.size();
+  }
+  jsonBytes /= notes.size();
+  double blockBytes = 0, records = 0;
+  for (const SimNote *block : blocks) {
+    blockBytes += block->binary.size();
+    records += Json_Number(block->body, "records");
+  }
+  CHECK(records > 0);
+  double binaryBytes = records > 0 ? blockBytes / records : 0;
+  printf("  bytes per record: packed %zu, binary block %.1f, JSON note body %.1f\n", sizeof(SampleRecord),
+         binaryBytes, jsonBytes);
+
+  CHECK(binaryBytes >= sizeof(SampleRecord));
+  CHECK(binaryBytes < sizeof(SampleRecord) + sizeof(BinaryBlockHeader));
+  CHECK(jsonBytes > 4 * sizeof(SampleRecord));
+}
+
+int main()
+{
+  Test_Run("records are packed", Record_Size);
+  Test_Run("the store keeps the newest records", Store_Round_Trip);
+  Test_Run("bytes per record, packed and as notes", Bytes_Per_Record);
+  return Test_Result();
+}
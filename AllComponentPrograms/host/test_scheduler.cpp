@@ -0,0 +1,154 @@
+// MULTI_RATE: each sensor task runs on its own epoch-aligned grid from a
+// timer wheel, and ENERGY_MODEL reconciles the interval means it produces
+// against the model's average current
+#define DEBUG 1
+#define MULTI_RATE 1
+#define ENERGY_MODEL 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+#include <vector>
+
+static std::vector<std::pair<uint32_t, uint8_t>> runs;  // (second, task) in the order they ran
+static uint32_t runNowS = 0;
+
+static void Record_Run(Task *task)
+{
+  runs.push_back(std::make_pair(runNowS, (uint8_t)(task - tasks)));
+}
+
+static void Run_Until(uint32_t untilS)
+{
+  // Wake only when the wheel says the next task is due, as loop() does
+  while (Scheduler_Next() <= untilS) {
+    runNowS = Scheduler_Next();
+    Scheduler_Run(runNowS);
+  }
+}
+
+static void Grid_And_Priority()
+{
+  tasks[TASK_INA260].run = Record_Run;
+  tasks[TASK_AHTX0].run = Record_Run;
+  Scheduler_Start(1000);
+  CHECK(Scheduler_Next() == 1020);
+  CHECK(Scheduler_Due(1019) == TASK_NONE);
+
+  // Ten minutes: the INA260 every minute, the AHTX0 on each 5-minute mark
+  // and ahead of it there, since both are due at the same second
+  Run_Until(1600);
+  size_t ina = 0, aht = 0;
+  for (size_t i = 0; i < runs.size(); i++) {
+    uint32_t atS = runs[i].first;
+    if (runs[i].second == TASK_INA260) {
+      ina++;
+      CHECK(atS % INA260_TASK_PERIOD_S == 0);
+    } else {
+      aht++;
+      CHECK(atS % AHTX0_TASK_PERIOD_S == 0);
+      CHECK(i > 0 && runs[i - 1].first == atS && runs[i - 1].second == TASK_INA260);
+    }
+  }
+  CHECK(ina == 10);
+  CHECK(aht == 2);
+  CHECK(Scheduler_Next() == 1620);
+
+  // Deadlines missed while the cycle was busy run once, then realign
+  runs.clear();
+  runNowS = 2000;
+  Scheduler_Run(runNowS);
+  CHECK(runs.size() == 2);
+  CHECK(tasks[TASK_INA260].dueS == 2040);
+  CHECK(tasks[TASK_AHTX0].dueS == 2100);
+}
+
+static void Slot_Mates_And_Long_Cadence()
+{
+  // Tasks WHEEL_SLOTS seconds apart share a slot; only the one due on the
+  // current turn runs
+  tasks[TASK_INA260].run = Record_Run;
+  tasks[TASK_AHTX0].run = Record_Run;
+  tasks[TASK_INA260].periodS = WHEEL_SLOTS;
+  tasks[TASK_AHTX0].periodS = 2 * WHEEL_SLOTS;
+  Scheduler_Start(0);
+  CHECK(tasks[TASK_INA260].dueS % WHEEL_SLOTS == tasks[TASK_AHTX0].dueS % WHEEL_SLOTS);
+  CHECK(Scheduler_Next() == WHEEL_SLOTS);
+  Run_Until(WHEEL_SLOTS);
+  CHECK(runs.size() == 1 && runs[0].second == TASK_INA260);
+
+  // Nothing due within a turn of the wheel falls back to the earliest deadline
+  runs.clear();
+  tasks[TASK_INA260].periodS = 900;
+  tasks[TASK_AHTX0].periodS = 600;
+  Scheduler_Start(100);
+  CHECK(Scheduler_Next() == 600);
+  Run_Until(1800);
+  CHECK(runs.size() == 5);  // The AHTX0 at 600, 1200 and 1800, the INA260 at 900 and 1800
+}
+
+static void Tasks_Feed_Reports()
+{
+  // The notes carry the means of every task reading since the last one
+  simWorld.currentMa = [](int, double t) {
+    return 100 + fmod(t, 900) / 9;  // 100 to 200 mA across each interval
+  };
+  double startS = Sim_True_S();
+  Sim_Run(startS + 3 * 3600);
+  CHECK(simSerialOut.find("Running task: ina260") != std::string::npos);
+  CHECK(simSerialOut.find("Running task: ahtx0") != std::string::npos);
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() >= 12);
+  for (size_t i = 2; i < notes.size(); i++) {
+    CHECK_NEAR(Json_Number(notes[i]->body, "current"), 150, 15);
+  }
+}
+
+static void Interval_Mean_Reconciles()
+{
+  // A mean over the whole interval is compared with the model's average
+  // over the cycle, not with the current it expects while the fan runs
+  unsigned long periodMs = 900000;
+  float modelledMa = 0;
+  float cycleMa = Energy_Cycle_mAh(cyclePhaseUs, 0, periodMs, &modelledMa) * 3.6e6 / periodMs;
+  CHECK(modelledMa > 2 * cycleMa);
+  sample.voltage[0] = 5000;
+  sample.power[0] = (uint16_t)lround(cycleMa * 5);
+  inaIntervalMean = true;
+  for (int i = 0; i < 20; i++) {
+    Energy_Update(periodMs);
+  }
+  CHECK_NEAR(energyScale, 1, 0.02);
+
+  // A reading taken in the sampling window still meets the fan-on model
+  energyScale = 1;
+  sample.power[0] = (uint16_t)lround(modelledMa * 5);
+  inaIntervalMean = false;
+  for (int i = 0; i < 20; i++) {
+    Energy_Update(periodMs);
+  }
+  CHECK_NEAR(energyScale, 1, 0.02);
+}
+
+static void Day_Of_Model_Current()
+{
+  // A station drawing what the model says it does: the fan and the modem
+  // on top of the idle current. The correction stays near 1.
+  simWorld.syncS = MODEM_SYNC_S;
+  simWorld.currentMa = [](int, double) {
+    return componentIdleMa[COMP_MCU] + componentIdleMa[COMP_INA260] +
+           (Sim_Fan_On() ? componentActiveMa[COMP_PM25AQI] : componentIdleMa[COMP_PM25AQI]) +
+           (Sim_Syncing() ? componentActiveMa[COMP_MODEM] : componentIdleMa[COMP_MODEM]);
+  };
+  Sim_Run(Sim_True_S() + 86400);
+  CHECK_NEAR(energyScale, 1, 0.3);
+}
+
+int main()
+{
+  Test_Run("tasks run on their grids, by priority", Grid_And_Priority);
+  Test_Run("slot mates and long cadences", Slot_Mates_And_Long_Cadence);
+  Test_Run("task means reach the notes", Tasks_Feed_Reports);
+  Test_Run("interval means meet the cycle average", Interval_Mean_Reconciles);
+  Test_Run("a day of modelled current", Day_Of_Model_Current, 20);
+  return Test_Result();
+}
@@ -0,0 +1,111 @@
+// The simulator itself: a default build runs its cycles on the marks, and
+// the fakes behave as the sketch expects
+#define DEBUG 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+
+static void Cycles_On_Marks()
+{
+  double startS = Sim_True_S();
+  Sim_Run(startS + 6 * 3600);
+
+  // A boot cycle, one per 15-minute mark, and the one loop() was waiting
+  // for when the time ran out
+  std::vector<CycleRow> rows = Sim_Cycle_Rows();
+  CHECK(rows.size() == 1 + 24 + 1);
+  CHECK(!rows.empty() && rows.back().missed == 0);
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() == rows.size());
+  for (size_t i = 1; i < notes.size(); i++) {
+    double sinceMarkS = fmod(notes[i]->trueS, 900);
+    CHECK(sinceMarkS < 120);  // Readings, a location fix and the note.add
+  }
+
+  // The fans only run around each sampling window, and never see 400 kHz
+  CHECK(Sim_Fan_On_S() < 0.15 * 6 * 3600);
+  CHECK(!Sim_Fan_On());
+  CHECK(simI2cFastPmTransfers == 0);
+}
+
+static void Offline_Then_Online()
+{
+  // Nothing can be timestamped until the Notecard answers; the sketch backs
+  // off instead of hammering it, then measures once it is back
+  simWorld.notecardOnline = false;
+  double startS = Sim_True_S();
+  Sim_At_Us(3600e6, []() { simWorld.notecardOnline = true; });
+  Sim_Run(startS + 3600);
+  size_t offlineRequests = simRequests.size();
+  CHECK(offlineRequests < 60);
+  CHECK(Sim_Notes("data.qo").empty());
+  Sim_Run(startS + 2 * 3600);
+  CHECK(!Sim_Notes("data.qo").empty());
+}
+
+static void Unknown_Time_Forces_Sync()
+{
+  // A factory-fresh Notecard only learns the time from a hub.sync
+  simWorld.notecardTimeKnown = false;
+  Sim_Run(Sim_True_S() + 1800);
+  CHECK(Sim_Requests("hub.sync") == 1);
+  CHECK(!Sim_Notes("data.qo").empty());
+}
+
+static std::vector<unsigned long> Clock_Retries(const char *deviceUID)
+{
+  // Retry delays of a unit that booted after an outage: the Notecard
+  // answers, but the network is still down, so it never learns the time
+  ForkResult unit = Test_Fork([deviceUID]() {
+    simWorld.deviceUID = deviceUID;
+    simWorld.notecardTimeKnown = false;
+    simWorld.syncS = 1e9;
+    Sim_Run(Sim_True_S() + 6 * 3600);
+  });
+  std::vector<unsigned long> delays;
+  const std::string prefix = "Retrying in ms: ";
+  for (size_t at = unit.serial.find(prefix); at != std::string::npos; at = unit.serial.find(prefix, at + 1)) {
+    delays.push_back(strtoul(unit.serial.c_str() + at + prefix.size(), NULL, 10));
+  }
+  return delays;
+}
+
+static void Retries_Spread_Apart()
+{
+  // Two stations that come back together draw different jitter, so their
+  // retries drift apart instead of hitting the network in step
+  std::vector<unsigned long> a = Clock_Retries("dev:864475044203262");
+  std::vector<unsigned long> b = Clock_Retries("dev:864475044208493");
+  CHECK(a.size() > 10 && b.size() > 10);
+  size_t n = std::min(a.size(), b.size());
+  size_t same = 0;
+  double aMs = 0, bMs = 0, apartMs = 0;
+  for (size_t i = 0; i < n; i++) {
+    same += a[i] == b[i];
+    aMs += a[i];
+    bMs += b[i];
+    apartMs += fabs(aMs - bMs);
+  }
+  CHECK(same < n / 4);
+  CHECK(apartMs / n > NOTECARD_BACKOFF_BASE_MS);
+
+  // The jitter comes from the seed alone: the same unit retries the same way
+  CHECK(Clock_Retries("dev:864475044203262") == a);
+}
+
+static void Day_Runs_Fast()
+{
+  double startS = Sim_True_S();
+  Sim_Run(startS + 86400);
+  CHECK(Sim_Cycle_Rows().size() >= 96);
+}
+
+int main()
+{
+  Test_Run("cycles start on the marks", Cycles_On_Marks);
+  Test_Run("notecard offline at boot", Offline_Then_Online);
+  Test_Run("unknown time forces one hub.sync", Unknown_Time_Forces_Sync);
+  Test_Run("differently seeded units spread their retries", Retries_Spread_Apart);
+  Test_Run("a simulated day runs in seconds", Day_Runs_Fast, 10);
+  return Test_Result();
+}
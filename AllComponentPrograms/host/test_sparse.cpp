@@ -0,0 +1,95 @@
+// SPARSE_PAYLOADS: notes only carry what changed, and the reconstructor in
+// reconstruct.h rebuilds every record the sketch stored from them
+#define DEBUG 1
+#define SPARSE_PAYLOADS 1
+#include "../mux_final_program.cpp"
+#include "sim_sketch.h"
+#include "test.h"
+#include "reconstruct.h"
+
+// The keyframe body the sketch would send for a stored record
+static std::string Full_Body(const SampleRecord &rec)
+{
+  J *req = Data_Note(&rec, true);
+  if (req == NULL) {
+    return "";
+  }
+  char *json = JPrintUnformatted(JGetObject(req, "body"));
+  std::string body = json;
+  JFree(json);
+  JDelete(req);
+  return body;
+}
+
+static void Moving_Readings()
+{
+  // Some channels move every cycle, some rarely, some never; two AHTX0s
+  // exercise the per-instance arrays. A day crosses midnight.
+  simWorld.ahtx0Ports = (1 << 1) | (1 << 3);
+  simWorld.temperatureC = [](int port, double t) { return 20 + port + 3 * sin(t / 5000); };
+  simWorld.humidityRh = [](int, double t) { return 40 + floor(t / 7200); };
+  simWorld.currentMa = [](int, double t) { return 180 + 40 * sin(t / 900); };
+  simWorld.pm25 = [](int, double t) { return 12 + (fmod(t, 10800) < 3600 ? 6 : 0); };
+  Sim_Run(Sim_True_S() + 86400);
+
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() >= 96);
+  CHECK(notes.size() >= sampleStore.count);
+
+  // Notes and the store line up newest first; every rebuilt record equals
+  // the full body of its stored record
+  SparseReconstructor reconstructor;
+  std::vector<FlatRecord> rebuilt;
+  size_t sparseBytes = 0, keyframes = 0;
+  for (const SimNote *note : notes) {
+    FlatRecord record;
+    CHECK(reconstructor.Add(note->body, &record));
+    rebuilt.push_back(record);
+    sparseBytes += note->body.size();
+    keyframes += note->body.find("\"key\":true") != std::string::npos;
+  }
+  CHECK(reconstructor.lost == 0);
+  CHECK(keyframes == (notes.size() + SPARSE_KEYFRAME_NOTES - 1) / SPARSE_KEYFRAME_NOTES);
+  size_t fullBytes = 0;
+  for (uint8_t i = 0; i < sampleStore.count; i++) {
+    SampleRecord rec;
+    CHECK(Store_Get(i, &rec));
+    std::string body = Full_Body(rec);
+    FlatRecord expected = Record_From_Json(body);
+    CHECK(expected.count("ahtx0[3].temperature") == 1);
+    CHECK(rebuilt[rebuilt.size() - 1 - i] == expected);
+    fullBytes += body.size();
+  }
+
+  // The point of it: sparse bodies average well under the full ones
+  double sparseMean = (double)sparseBytes / notes.size();
+  double fullMean = (double)fullBytes / sampleStore.count;
+  CHECK(sparseMean < 0.7 * fullMean);
+  printf("  data note body bytes: full %.0f, sparse %.0f\n", fullMean, sparseMean);
+}
+
+static void Lost_Note_Waits_For_Keyframe()
+{
+  Sim_Run(Sim_True_S() + 6 * 3600);
+  std::vector<const SimNote *> notes = Sim_Notes("data.qo");
+  CHECK(notes.size() > 2 * SPARSE_KEYFRAME_NOTES);
+
+  // Drop the note after the first keyframe, as if a route had lost it
+  SparseReconstructor reconstructor;
+  size_t rebuilt = 0;
+  for (size_t i = 0; i < notes.size(); i++) {
+    FlatRecord record;
+    bool ok = (i != 1) && reconstructor.Add(notes[i]->body, &record);
+    CHECK(ok == (i == 0 || i >= SPARSE_KEYFRAME_NOTES));
+    rebuilt += ok;
+  }
+  CHECK(reconstructor.lost == 1);
+  CHECK(rebuilt == notes.size() - (SPARSE_KEYFRAME_NOTES - 1));
+}
+
+int main()
+{
+  Test_Run("sparse notes rebuild the stored records", Moving_Readings);
+  Test_Run("a lost note holds off until the keyframe", Lost_Note_Waits_For_Keyframe);
+  return Test_Result();
+}
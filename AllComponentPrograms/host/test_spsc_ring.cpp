@@ -0,0 +1,75 @@
+// SpscRing on its own: a producer thread and a consumer thread hammer a
+// small ring, standing in for the interrupt handler and loop(). Every item
+// must arrive once, in order, or be counted as dropped.
+#include <sched.h>
+#include <thread>
+#include <vector>
+#include "../spsc_ring.h"
+#include "test.h"
+
+// Built without the fakes, which would bring the sketch in with them
+std::string simSerialOut;
+
+static const uint32_t STRESS_ITEMS = 2000000;
+
+struct StressItem {
+  uint32_t seq;
+  uint32_t check;  // Catches an item read before it was fully written
+};
+
+static void Single_Thread()
+{
+  SpscRing<uint16_t, 4> ring = {};
+  uint16_t out[4];
+  CHECK(Ring_Pop(&ring, out, 4) == 0);
+  CHECK(Ring_Push(&ring, (uint16_t)1) && Ring_Push(&ring, (uint16_t)2) && Ring_Push(&ring, (uint16_t)3));
+  CHECK(!Ring_Push(&ring, (uint16_t)4));  // One slot stays empty
+  CHECK(ring.dropped == 1);
+  CHECK(Ring_Pop(&ring, out, 2) == 2 && out[0] == 1 && out[1] == 2);
+  CHECK(Ring_Push(&ring, (uint16_t)5) && Ring_Push(&ring, (uint16_t)6));  // Wraps around
+  CHECK(Ring_Pop(&ring, out, 4) == 3 && out[0] == 3 && out[1] == 5 && out[2] == 6);
+}
+
+static void Two_Threads()
+{
+  static SpscRing<StressItem, 16> ring = {};
+  std::thread producer([]() {
+    for (uint32_t seq = 0; seq < STRESS_ITEMS;) {
+      if (Ring_Push(&ring, StressItem{ seq, ~seq })) {
+        seq++;
+      } else {
+        sched_yield();  // Full; on one CPU the consumer has to run
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  bool inOrder = true;
+  StressItem items[8];
+  while (expected < STRESS_ITEMS && inOrder) {
+    uint8_t count = Ring_Pop(&ring, items, 8);
+    if (count == 0) {
+      sched_yield();
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      if (items[i].seq != expected || items[i].check != ~expected) {
+        fprintf(stderr, "got %u/%08x, expected %u\n", items[i].seq, items[i].check, expected);
+        inOrder = false;
+        break;
+      }
+      expected++;
+    }
+  }
+  producer.join();
+  CHECK(inOrder);
+  CHECK(expected == STRESS_ITEMS);
+  CHECK(Ring_Pop(&ring, items, 8) == 0);
+  CHECK(ring.dropped > 0);  // The ring did fill up along the way
+}
+
+int main()
+{
+  Test_Run("ring fills, wraps and drops", Single_Thread);
+  Test_Run("two threads, no loss and in order", Two_Threads, 30);
+  return Test_Result();
+}
@@ -1,72 +1,740 @@
 
 #include <Arduino.h>
-#include <time.h> 
 #include <Notecard.h>
 #include <Adafruit_PM25AQI.h>   // Air Quality Sensor
 #include <Adafruit_INA260.h>   // Voltage, Current, Power Sensor
 #include <Adafruit_AHTX0.h>   // Air Temperature and Humidity Sensor
 #include <SparkFun_I2C_Mux_Arduino_Library.h>
+#include "spsc_ring.h"  // Interrupt-to-loop() queue
 
 #define productUID "edu.umn.d.cshill:engr_1210_fall_2024"  // Product UID for Notecard
 
+// Feature flags. Each can also be set with -D, which the host build in
+// host/ uses to test every variant from the same source.
+#ifndef DEBUG
 #define DEBUG 0
+#endif
+#ifndef DEBUG_DEFERRED
+#define DEBUG_DEFERRED 0  // With DEBUG, queue debug output in RAM and send it as binary records while idle
+#endif
+#ifndef PROFILE
+#define PROFILE 0  // Time each cycle phase and report percentiles and Notecard stats in a health.qo note
+#endif
+#ifndef ENERGY_MODEL
+#define ENERGY_MODEL 0  // Estimate mAh per cycle and per day from the phases each cycle runs
+#endif
+#ifndef HIGH_RATE_ACQUISITION
+#define HIGH_RATE_ACQUISITION 0  // Sample INA260 (CIC-decimated) and every PM2.5 frame continuously while awake
+#endif
+#ifndef SPARSE_PAYLOADS
+#define SPARSE_PAYLOADS 0  // Leave fields unchanged since the last data note out of the body
+#endif
+#ifndef BINARY_UPLOAD
+#define BINARY_UPLOAD 0  // Upload burst records as packed blocks through the Notecard binary buffer
+#endif
+#ifndef EPOCH_TIME
+#define EPOCH_TIME 0  // Send one epoch "time" integer instead of the YYYY/MM/DD/hh/mm/ss strings
+#endif
+#ifndef MULTI_RATE
+#define MULTI_RATE 0  // Read the INA260 and AHTX0 on their own cadences between reports
+#endif
+#ifndef COROUTINE_READS
+#define COROUTINE_READS 0  // Interleave the sensor reads and location search as coroutines (C++20)
+#endif
+#ifndef INTERRUPT_CAPTURE
+#define INTERRUPT_CAPTURE 0  // Take INA260 conversion-ready alerts and Notecard ATTN through interrupts
+#endif
 
-#define INA260_MUX_PORT 0
-#define AHTX0_MUX_PORT 1
-#define PM25AQI_MUX_PORT 2
+#define MUX_PORTS 8  // QWIICMUX ports scanned for sensors at boot
+#define MAX_SENSOR_INSTANCES 2  // Sensors of each type sampled; extra ones found are ignored
+
+#define I2C_FAST_HZ 400000  // Mux, INA260 and AHTX0 all support fast mode
+#define I2C_STANDARD_HZ 100000  // PMSA003I is limited to standard mode
+#define INA260_I2C_ADDR 0x40
+#define AHTX0_I2C_ADDR 0x38
+#define PM25AQI_I2C_ADDR 0x12
+#define INA260_REG_CURRENT 0x01  // Signed, 1.25 mA per bit
+#define INA260_REG_BUS_VOLTAGE 0x02  // 1.25 mV per bit
+
+#define PM25AQI_SET_PIN 5  // PMSA003I SET pin(s): HIGH = running, LOW = sleep (fan and laser off)
+#define INA260_ALERT_PIN 6  // INA260 ALERT outputs, open-drain and wired together
+#define NOTECARD_ATTN_PIN 9  // Notecard ATTN, goes high when an armed event fires
+#define PM25AQI_WARMUP_S 30  // Seconds the fan needs to run before readings are stable
+#define PM_HUMIDITY_KAPPA 0.62  // Hygroscopicity of the aerosol for the kappa-Kohler growth model
+#define PM_HUMIDITY_STEP 5  // %RH between lookup table entries
+#define PM_HUMIDITY_MAX_RH 95  // Growth runs away near saturation, clamp the correction here
+
+#define CLOCK_MAX_ERROR_MS 2000  // Re-sync with the Notecard once the time error bound exceeds this
+#define CLOCK_SYNC_ERROR_MS 150  // Uncertainty of a single sync against the card.time second edge
+#define CLOCK_DRIFT_BOUND_PPM 200  // Worst-case millis() drift assumed before it has been measured
+#define CLOCK_WANDER_PPM 5  // Drift change (temperature, aging) allowed for after it has been measured
+#define CLOCK_MIN_BASELINE_S 3600  // Shortest sync-to-sync baseline used to estimate drift
+
+#define PROFILE_BUCKETS 30  // Histogram bucket n counts durations in [2^n, 2^(n+1)) microseconds
+#define PROFILE_REPORT_CYCLES 96  // Send health.qo once a day (96 x 15 minutes)
+
+#define NOTECARD_STATS_SLOTS 12  // Distinct request types tracked; extras share the last slot
+#define NOTECARD_BREAKER_FAILURES 3  // Consecutive unanswered requests that open the circuit breaker
+#define NOTECARD_BACKOFF_BASE_MS 1000UL  // First retry delay
+#define NOTECARD_BACKOFF_MAX_MS 900000UL  // Retry delays stop doubling here
+
+#define CHECKPOINT_MAGIC 0x41514350UL  // "AQCP", marks a checkpoint written by this firmware
+#define BOOT_SETTLE_MS 250  // Sensor power-on time before the first I2C access (AHT20 needs 40 ms)
+#define CYCLE_DEADLINE_MS 5000  // A cycle starting later than this after its mark counts as missed
+
+#define MODEM_SYNC_S 45  // Time the modem stays on to sync after a note.add with sync:true
+#define SYNC_CHECK_MS 10000UL  // hub.sync.status polling interval while a data note's sync runs
+#define SYNC_CHECK_TIMEOUT_MS 300000UL  // Poll for inbound changes anyway once a sync takes this long
+#define ENERGY_SCALE_WEIGHT 0.1  // Weight of each INA260 comparison in the model correction
+
+// Components with a separate current draw in the energy model
+enum Component {
+  COMP_MCU,
+  COMP_MODEM,  // Notecard cellular modem
+  COMP_GPS,  // Notecard GNSS receiver
+  COMP_PM25AQI,  // PMSA003I fan and laser
+  COMP_AHTX0,
+  COMP_INA260,
+  COMP_COUNT
+};
+
+// Reported channels, each with its own deadband in sample record units
+enum Channel {
+  CHANNEL_TEMPERATURE,  // C x 100
+  CHANNEL_HUMIDITY,  // %RH x 100
+  CHANNEL_PM_MASS,  // ug/m3 x 10
+  CHANNEL_PM_COUNT,  // Particles per 0.1 L
+  CHANNEL_CURRENT,  // mA
+  CHANNEL_VOLTAGE,  // mV
+  CHANNEL_POWER,  // mW
+  CHANNEL_COUNT
+};
+
+// Cycle phases timed by the profiling probes
+enum Phase {
+  PHASE_WAIT,  // Busy wait for the 15-minute mark
+  PHASE_MUX,  // A single mux port switch
+  PHASE_INA260,
+  PHASE_PM25AQI,
+  PHASE_AHTX0,
+  PHASE_LOCATION,
+  PHASE_SEND,
+  PHASE_JITTER,  // Distance of the measurement start from the 15-minute mark
+  PHASE_COUNT
+};
+
+#define PM_FIELDS 12  // Values averaged from each PM2.5 frame
+#define SAMPLE_STORE_RECORDS 96  // Cycles of history kept in RAM (one day at 15 minutes)
+#define SPARSE_KEYFRAME_NOTES 8  // Every Nth data note carries every field
+#define LOG_ENTRIES 128  // Deferred debug log ring size (8-bit indices, at most 256)
+#define LOG_TEXT_BYTES 24  // Longest non-literal string copied into a log entry; fits a request name
+#define LOG_FORMATS 96  // String literals given a format ID by the deferred log; any more are sent as text
+#define LOG_RECORD_BYTES 128  // Longest deferred log record before framing; longer literals are cut
+#define LOG_NEWLINE 0x80  // Set in a deferred log record's type byte when a line break follows
+#define BINARY_BLOCK_RECORDS 16  // Records packed into one binary block and note
+#define BINARY_CHUNK_BYTES 1536  // Largest chunk per card.binary.put; a full block fits in one
+
+#define DECIMATION_FACTOR 16  // Raw samples per decimated output in high-rate mode
+#define DECIMATION_ORDER 2  // Cascaded integrator-comb stages
+#define INA260_TASK_PERIOD_S 60  // Multi-rate cadence of the INA260 task
+#define AHTX0_TASK_PERIOD_S 300  // Multi-rate cadence of the AHTX0 task
+#define TASK_VALUES 3  // Most values a task averages per sensor instance
+#define WHEEL_SLOTS 64  // Timer wheel slots, one second each
+#define COROUTINE_TASKS 4  // Coroutines the executor can hold at once
+#define COROUTINE_FRAME_BYTES 512  // Static arena slot per coroutine frame
+#define CAPTURE_RING_EVENTS 32  // INA260 alerts buffered between drains (about 30 s of conversions)
+#define CAPTURE_BATCH 8  // Events taken from a ring per pop
+
+// Streaming CIC decimator. Integrators run at the input rate, combs at the
+// output rate, and the decimated outputs are averaged over the reporting
+// window, so memory is constant however many samples arrive. The sums are
+// exact integers: an awake window with a full GPS search is over a million
+// inputs, which a float sum or a 16-bit count would not survive.
+struct Decimator {
+  uint32_t integrator[DECIMATION_ORDER];  // Wrap-around arithmetic is exact for CIC filters
+  uint32_t comb[DECIMATION_ORDER];
+  uint8_t phase;  // Inputs since the last output
+  uint32_t outputs;  // Decimated outputs produced, including the settling ones
+  int64_t outputSum;  // Sum of settled outputs, still scaled by the CIC gain
+  int64_t rawSum;  // Plain mean fallback for windows too short to settle
+  uint32_t rawCount;
+};
+
+// Sensor read on its own cadence between reports. Each task sums its
+// readings until the next report stores their means in the sample.
+enum TaskId {
+  TASK_INA260,
+  TASK_AHTX0,
+  TASK_COUNT,
+  TASK_NONE = 0xFF
+};
+struct Task {
+  const char *name;
+  uint16_t periodS;  // Cadence, aligned to the epoch
+  uint8_t priority;  // Lower runs first when deadlines coincide
+  void (*run)(struct Task *task);
+  uint32_t dueS;  // Next deadline (UTC seconds)
+  uint8_t next;  // Next task in the same wheel slot, TASK_NONE at the end
+  float sum[TASK_VALUES][MAX_SENSOR_INSTANCES];  // Readings since the last report
+  uint16_t count[MAX_SENSOR_INSTANCES];
+};
+
+// Event recorded by an interrupt handler; the ring it is in says which one
+struct CaptureEvent {
+  unsigned long us;  // micros() when the interrupt fired
+};
+
+#if COROUTINE_READS
+#ifndef __cpp_impl_coroutine
+#error "COROUTINE_READS needs a compiler with C++20 coroutines (-std=gnu++20)"
+#endif
+#include <coroutine>
+
+// A read or search running as a stackless coroutine. Frames come from a
+// static arena rather than the heap, and the executor resumes each task
+// once the sleep it is waiting on has run out.
+struct SensorTask {
+  struct promise_type {
+    unsigned long sleepStartMs = 0;
+    unsigned long sleepMs = 0;
+
+    SensorTask get_return_object() { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+    static SensorTask get_return_object_on_allocation_failure() { return { nullptr }; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }  // The executor destroys finished tasks
+    void return_void() {}
+    void unhandled_exception() {}
+    static void *operator new(size_t size) noexcept;
+    static void operator delete(void *frame) noexcept;
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+// The read functions are written once; these make them coroutines when
+// COROUTINE_READS is set and plain blocking functions otherwise
+#define READ_TASK SensorTask
+#define READ_SLEEP(ms) co_await Sleep_For(ms)
+#define READ_REQUEST(req) co_await Notecard_Await(req)
+#define READ_RETURN co_return
+#else
+#define READ_TASK void
+#define READ_SLEEP(ms) Acquire_For(ms)
+#define READ_REQUEST(req) Notecard_Transaction(req)
+#define READ_RETURN return
+#endif
 
 // Object declarations for the Notecard and sensors
 Notecard notecard;
-Adafruit_AHTX0 aht;
-Adafruit_PM25AQI aqi;
-Adafruit_INA260 ina260;
+Adafruit_AHTX0 aht[MAX_SENSOR_INSTANCES];
+Adafruit_PM25AQI aqi[MAX_SENSOR_INSTANCES];
+Adafruit_INA260 ina260[MAX_SENSOR_INSTANCES];
 QWIICMUX myMux;
 
+// Mux ports of the sensors found by Sensors_Discover()
+uint8_t ahtPorts[MAX_SENSOR_INSTANCES], aqiPorts[MAX_SENSOR_INSTANCES], ina260Ports[MAX_SENSOR_INSTANCES];
+uint8_t ahtCount = 0, aqiCount = 0, ina260Count = 0;
+unsigned long portClockHz[MUX_PORTS];  // Fastest bus clock every device on the port supports
+
+// One cycle's readings packed into fixed-point fields. Instance k of each
+// sensor type is at index k; unused instances stay zero.
+struct SampleRecord {
+  uint32_t time;  // UTC seconds of the location fix
+  int32_t lat;  // Degrees x 1e5
+  int32_t lon;  // Degrees x 1e5
+  int16_t temperature[MAX_SENSOR_INSTANCES];  // Degrees C x 100
+  uint16_t humidity[MAX_SENSOR_INSTANCES];  // %RH x 100
+  int16_t current[MAX_SENSOR_INSTANCES];  // mA
+  uint16_t voltage[MAX_SENSOR_INSTANCES];  // mV
+  uint16_t power[MAX_SENSOR_INSTANCES];  // mW
+  uint16_t pm[MAX_SENSOR_INSTANCES][PM_FIELDS];  // pmFieldNames order, scaled by pmFieldScale
+};
+
+// Ring buffer of the last SAMPLE_STORE_RECORDS records, stored field by
+// field so every field keeps its compact type and the RAM cost is fixed
+struct SampleStore {
+  uint32_t time[SAMPLE_STORE_RECORDS];
+  int32_t lat[SAMPLE_STORE_RECORDS];
+  int32_t lon[SAMPLE_STORE_RECORDS];
+  int16_t temperature[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES];
+  uint16_t humidity[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES];
+  int16_t current[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES];
+  uint16_t voltage[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES];
+  uint16_t power[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES];
+  uint16_t pm[SAMPLE_STORE_RECORDS][MAX_SENSOR_INSTANCES][PM_FIELDS];
+  uint8_t head;  // Slot the next record is written to
+  uint8_t count;  // Valid records, up to SAMPLE_STORE_RECORDS
+};
+SampleStore sampleStore;
+
+// Progress through a cycle, saved after each step so a reset can resume it
+enum CheckpointPhase {
+  CHECKPOINT_NONE,  // No cycle in progress
+  CHECKPOINT_INA260,  // INA260 readings are in the sample
+  CHECKPOINT_PM25AQI,
+  CHECKPOINT_AHTX0,
+  CHECKPOINT_LOCATION  // Sample complete, not yet stored and sent
+};
+
+// Retained RAM that the C runtime does not zero on reset. A brown-out or
+// watchdog reset leaves it intact; a power cycle leaves garbage, which the
+// magic number and CRC reject.
+//
+// The STM32duino linker scripts (Blues Swan) have no .noinit output
+// section, so the linker places it as an orphan after .bss. That keeps it
+// out of the _sbss.._ebss range Reset_Handler zeroes, but nothing pins it
+// ahead of the heap. Checkpoint_Retained() checks where it actually ended
+// up at boot and turns checkpointing off rather than write into the heap.
+struct Checkpoint {
+  uint32_t magic;
+  uint8_t phase;  // Last CheckpointPhase completed
+  uint8_t notesUnsent;
+  uint32_t cycleEpoch;  // When the interrupted cycle started (UTC seconds)
+  SampleRecord sample;  // Readings gathered so far
+  uint32_t crc;  // CRC-32 of everything above
+};
+Checkpoint checkpoint __attribute__((section(".noinit")));
+uint8_t resumePhase = CHECKPOINT_NONE;  // Steps of the first cycle already done before a reset
+bool checkpointRetained = true;  // False if the checkpoint landed where startup or the heap overwrites it
+#if defined(ARDUINO_ARCH_STM32)
+extern "C" uint8_t _sbss[], _ebss[], end[];  // Linker script symbols: zeroed .bss, heap start
+#endif
+
+// Timestamp split into the strings the dashboard expects
+struct TimeFields {
+  char yyyy[5], mM[3], dd[3], hh[3], mm[3], ss[3];
+};
+
+#if BINARY_UPLOAD
+// Header at the start of every binary block, followed by the packed
+// SampleRecords, oldest first, in the MCU's little-endian layout
+struct BinaryBlockHeader {
+  char magic[2];  // "AQ"
+  uint8_t version;
+  uint8_t records;
+  uint16_t recordBytes;  // sizeof(SampleRecord)
+  uint16_t reserved;
+  uint32_t firstTime;  // Time of the oldest record
+  uint32_t crc32;  // CRC-32 (IEEE) of the packed records
+};
+const uint32_t binaryBlockBytes = sizeof(BinaryBlockHeader) + BINARY_BLOCK_RECORDS * sizeof(SampleRecord);
+alignas(4) uint8_t binaryBlock[binaryBlockBytes];  // The whole block, packed before any of it is sent
+uint8_t binaryChunk[BINARY_CHUNK_BYTES + BINARY_CHUNK_BYTES / 254 + 8];  // Room for the COBS encoding
+uint8_t binaryPending = 0;  // Newest records not yet uploaded
+unsigned long binaryBytes = 0;  // Totals since boot, for throughput
+unsigned long binaryMs = 0;
+#endif
+SampleRecord sample;  // Record being filled by the current cycle
+bool inaIntervalMean = false;  // The record's INA260 values average the whole interval, not the sampling window
+
+// Settings that can be changed from Notehub through environment variables.
+// The defaults apply until the Notecard reports a value; Config_Poll()
+// parses the variables only when env.modified says they changed. Deadband
+// skipping stays off until max_silence_s is set, so a default deployment
+// keeps its usual note and sync every cycle.
+struct Config {
+  unsigned long intervalMs;  // Sampling interval, aligned to the epoch
+  uint8_t numReadings;  // Readings averaged per sensor per cycle
+  unsigned long spacingMs;  // Time between readings
+  unsigned long gpsTimeoutS;  // Longest wait for a location fix
+  uint8_t muxPortMask;  // Bit n set = scan mux port n for sensors
+  unsigned long maxSilenceS;  // Longest gap between data notes, 0 = report every cycle
+  uint16_t deadband[CHANNEL_COUNT];  // Change from the last note needed to report again
+};
+Config config = { 900000UL, 10, 500, 600, 0xFF, 0, { 20, 100, 20, 50, 10, 100, 50 } };
+const char *const channelNames[CHANNEL_COUNT] = {
+  "temperature", "humidity", "pm_mass", "pm_count", "current", "voltage", "power"
+};
+
+// Last record sent in a data note, for the deadband comparison
+SampleRecord reported;
+bool reportedValid = false;
+unsigned long notesSkipped = 0;
+uint32_t noteSeq = 0;  // Data notes accepted by the Notecard since boot
+#if DEBUG
+unsigned long dataBodyBytes = 0;
+unsigned long dataBodies = 0;
+#endif
+JINTEGER configModified = 0;  // env.modified time the cached config was read at
+
+// Burst sampling requested through commands.qi; overrides config.intervalMs
+// until burstUntilMs (epoch ms)
+uint64_t burstUntilMs = 0;
+unsigned long burstIntervalMs = 0;
+
+// note.add with sync:true returns before the sync runs, so commands and env
+// changes it brings in are picked up once hub.sync.status says it finished
+unsigned long syncStartMs = 0;  // millis() when the data note went out, 0 = nothing to wait for
+unsigned long syncCheckMs = 0;  // millis() of the last hub.sync.status
+
 // Function prototypes
-void Notecard_Find_Location();
-void Read_AHTX0();
-void Read_INA260();
-void Read_PM25AQI();
+READ_TASK Notecard_Find_Location();
+READ_TASK Read_AHTX0();
+READ_TASK Read_INA260();
+READ_TASK Read_PM25AQI();
 void Send_Data();
+J *Data_Note(const SampleRecord *rec, bool key);
+void Time_Format(uint32_t time, TimeFields *out);
+void Two_Digits(char *out, uint8_t value);
+#if BINARY_UPLOAD
+bool Binary_Upload(uint8_t firstAge, uint8_t count);
+bool Binary_Transmit(const void *data, uint32_t len, uint32_t offset);
+#endif
+uint32_t Crc32(uint32_t crc, const void *data, size_t len);
+bool Report_Due(const SampleRecord *rec);
+bool Outside_Deadband(long value, long last, Channel channel);
 void Set_Time_Location(J *rsp);
 void SetNotecardToOffMode();
+void Report_Cycle(unsigned long awakeMs, unsigned long transactions, unsigned long bytesSent,
+                  unsigned long bytesReceived, bool missed);
+void PM25AQI_Wake();
+void PM25AQI_Sleep();
+void Store_Push(const SampleRecord *rec);
+bool Store_Get(uint8_t age, SampleRecord *rec);
+long Fixed(float value, float scale, long minValue, long maxValue);
+void Sensors_Discover();
+void Config_Poll();
+void Command_Poll();
+void Command_Apply(J *body);
+bool Sync_Completed(unsigned long sinceMs);
+unsigned long Sample_Interval_Ms(uint64_t nowMs);
+unsigned long Config_Value(J *body, const char *name, unsigned long value, unsigned long minValue,
+                           unsigned long maxValue, bool hex);
+bool INA260_Read(uint8_t k, float *currentMa, float *voltageMv);
+void PM25AQI_Fields(const PM25_AQI_Data *data, float *fields);
+void Acquire_For(unsigned long ms);
+void Decimator_Reset(Decimator *d);
+void Acquire_Finish();
+void Decimator_Add(Decimator *d, int32_t x);
+float Decimator_Mean(const Decimator *d);
+float PM_Humidity_Correct(float pm, float rh);
+#if MULTI_RATE
+void Scheduler_Start(uint32_t nowS);
+uint8_t Scheduler_Due(uint32_t nowS);
+void Scheduler_Run(uint32_t nowS);
+uint32_t Scheduler_Next();
+void Wheel_Insert(uint8_t id);
+void Wheel_Remove(uint8_t id);
+void Task_INA260(Task *task);
+void Task_AHTX0(Task *task);
+bool Task_Store_INA260();
+bool Task_Store_AHTX0();
+#endif
+#if COROUTINE_READS
+bool Executor_Spawn(SensorTask task);
+void Executor_Run();
+bool Executor_Check();
+#endif
+#if MULTI_RATE || INTERRUPT_CAPTURE
+bool INA260_Store_Means(float (*sum)[MAX_SENSOR_INSTANCES], uint16_t *count);
+#endif
+#if INTERRUPT_CAPTURE
+void Capture_Begin();
+bool Capture_Arm_Attn();
+void Capture_Drain();
+void Capture_Read_INA260();
+bool Capture_Store_INA260();
+void INA260_Alert_ISR();
+void Notecard_Attn_ISR();
+#endif
+void Mux_Select(uint8_t port);
+bool I2C_Probe(uint8_t addr);
+bool I2C_Read_Registers(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len);
+void I2C_Account(uint8_t transactions, uint16_t bytes);
+J *Notecard_Transaction(J *req);
+bool Notecard_Breaker_Open();
+unsigned long Backoff_Ms(uint8_t attempt);
+void Random_Seed(const char *deviceUID);
+bool Send_Record(const SampleRecord *rec, bool key);
+void Checkpoint_Save(uint8_t phase, uint32_t cycleEpoch);
+bool Checkpoint_Restore();
+bool Checkpoint_Retained();
+bool Notecard_Send(J *req);
+void Notecard_Report_Stats(J *body);
+bool Clock_Sync();
+uint64_t Clock_Now_Ms(unsigned long *errorMs);
+// Debug output. The macros note whether the argument is written as a string
+// literal, the only kind of string the deferred log may keep by address.
+#define debugPrint(message) Debug_Print(message, #message[0] == '"', false)
+#define debugPrintln(message) Debug_Print(message, #message[0] == '"', true)
 template <typename T>
-void debugPrint(T message);
+void Debug_Print(const T &message, bool literal, bool newline);
+void debugFlush();
+void debugDrain();
+#if DEBUG && DEBUG_DEFERRED
+uint16_t Log_Format_Id(const char *literal);
+size_t Log_Put_Text(uint8_t *record, const char *text);
+void Log_Send(const uint8_t *record, size_t len);
 template <typename T>
-void debugPrintln(T message);
-
-// Variables to store time and location data
-char yyyy[5];
-char mM[3];
-char dd[3];
-char hh[3];
-char mm[3];
-char ss[3];
-double lat;
-double lon;
-
-// Variables to store sensor readings
-float temperature;
-float humidity;
-float current;
-float voltage;
-float power;
-
-// PM2.5 AQI sensor variables for standard and environmental particulate concentrations
-float pm10_standard, pm25_standard, pm100_standard;
-float pm10_env, pm25_env, pm100_env;
-
-// Variables to store particle counts
-uint16_t particles_03um;
-uint16_t particles_05um;
-uint16_t particles_10um;
-uint16_t particles_25um;
-uint16_t particles_50um;
-uint16_t particles_100um;
+void Log_Literal(const T &message, bool newline);
+template <size_t N>
+void Log_Literal(const char (&message)[N], bool newline);
+void Log_Arg(const char *message, bool newline);
+void Log_Arg(int value, bool newline);
+void Log_Arg(unsigned int value, bool newline);
+void Log_Arg(long value, bool newline);
+void Log_Arg(unsigned long value, bool newline);
+void Log_Arg(double value, bool newline);
+#endif
+
+#if PROFILE
+void Profile_Record(Phase phase, unsigned long us);
+void Send_Health();
+#endif
+#if ENERGY_MODEL
+float Energy_Cycle_mAh(const unsigned long *phaseUs, unsigned long fanOnMs, unsigned long periodMs,
+                       float *modelledMa);
+void Energy_Update(unsigned long periodMs);
+#endif
+#if PROFILE || ENERGY_MODEL
+void Phase_Record(Phase phase, unsigned long us);
+#define PROBE_START(phase) unsigned long probeStart_##phase = micros()
+#define PROBE_STOP(phase) Phase_Record(phase, micros() - probeStart_##phase)
+#define PROBE(phase, statement) do { PROBE_START(phase); statement; PROBE_STOP(phase); } while (0)
+#else
+#define PROBE_START(phase)
+#define PROBE_STOP(phase)
+#define PROBE(phase, statement) statement
+#endif
+
+const char *const pmFieldNames[PM_FIELDS] = {
+  "pm10_standard", "pm25_standard", "pm100_standard", "pm10_env", "pm25_env", "pm100_env",
+  "particles_03um", "particles_05um", "particles_10um", "particles_25um", "particles_50um", "particles_100um"
+};
+const float pmFieldScale[PM_FIELDS] = { 10, 10, 10, 10, 10, 10, 1, 1, 1, 1, 1, 1 };  // ug/m3 x 10, counts per 0.1 L
+
+// Humidity correction for the optical PM mass readings. Particles take up
+// water and grow, so the sensor over-reads as RH rises; the kappa-Kohler
+// mass growth factor is C = 1 + (kappa / 1.65) / (100 / RH - 1). The table
+// holds 1 / C at every PM_HUMIDITY_STEP %RH, evaluated by the compiler.
+constexpr float PM_Humidity_Factor(float rh)
+{
+  return 1.0 / (1.0 + (PM_HUMIDITY_KAPPA / 1.65) / (100.0 / rh - 1.0));
+}
+constexpr float pmHumidityTable[] = {
+  1.0, PM_Humidity_Factor(5), PM_Humidity_Factor(10), PM_Humidity_Factor(15),
+  PM_Humidity_Factor(20), PM_Humidity_Factor(25), PM_Humidity_Factor(30), PM_Humidity_Factor(35),
+  PM_Humidity_Factor(40), PM_Humidity_Factor(45), PM_Humidity_Factor(50), PM_Humidity_Factor(55),
+  PM_Humidity_Factor(60), PM_Humidity_Factor(65), PM_Humidity_Factor(70), PM_Humidity_Factor(75),
+  PM_Humidity_Factor(80), PM_Humidity_Factor(85), PM_Humidity_Factor(90), PM_Humidity_Factor(95)
+};
+static_assert(sizeof(pmHumidityTable) / sizeof(pmHumidityTable[0]) == PM_HUMIDITY_MAX_RH / PM_HUMIDITY_STEP + 1,
+              "pmHumidityTable must cover 0 to PM_HUMIDITY_MAX_RH");
+
+// PM2.5 AQI sensor fan duty-cycle bookkeeping
+unsigned long pmWakeMs = 0;  // millis() when the sensor was last woken
+unsigned long pmFanOnMs = 0;  // Total time the fan has been running since boot
+uint16_t pmFramesDiscarded = 0;  // Frames thrown away during warm-up since boot
+
+#if HIGH_RATE_ACQUISITION
+// Decimators fed by Acquire_For() during the awake window
+Decimator inaCurrentDecimator[MAX_SENSOR_INSTANCES];  // mA x 10
+Decimator inaVoltageDecimator[MAX_SENSOR_INSTANCES];  // mV
+Decimator inaPowerDecimator[MAX_SENSOR_INSTANCES];  // mW
+// The PMSA003I only updates its frame about once a second, too few inputs
+// in a sampling window for the CIC to settle, so new frames are summed in a
+// plain boxcar instead, in pmFieldNames units
+float pmBoxcarSum[MAX_SENSOR_INSTANCES][PM_FIELDS];
+uint16_t pmBoxcarFrames[MAX_SENSOR_INSTANCES];
+uint16_t pmLastChecksum[MAX_SENSOR_INSTANCES];  // Frames repeat until the sensor updates them
+bool pmAcquiring = false;  // PM2.5 frames are only used inside the sampling window
+unsigned long highRateSamples = 0;
+bool inaDecimating = false;  // This cycle's INA260 values come from the decimators, not a capture or task
+#endif
+uint8_t muxPort = MUX_PORTS;  // Port the mux has selected, MUX_PORTS until the first selection
+
+#if MULTI_RATE
+// Hashed timer wheel: slot s % WHEEL_SLOTS chains the tasks due at second s,
+// or on a later turn of the wheel
+Task tasks[TASK_COUNT] = {
+  { "ina260", INA260_TASK_PERIOD_S, 0, Task_INA260 },
+  { "ahtx0", AHTX0_TASK_PERIOD_S, 1, Task_AHTX0 }
+};
+uint8_t wheel[WHEEL_SLOTS];  // First task in each slot
+uint32_t wheelCursorS = 0;  // Next second the wheel has to visit
+bool schedulerStarted = false;
+#endif
+
+#if COROUTINE_READS
+// co_await Sleep_For(ms): resume after ms, running other tasks meanwhile
+struct SleepAwaiter {
+  unsigned long ms;
+
+  bool await_ready() const noexcept { return false; }  // Even a zero sleep lets the others run
+  void await_suspend(std::coroutine_handle<SensorTask::promise_type> task) const noexcept
+  {
+    task.promise().sleepStartMs = millis();
+    task.promise().sleepMs = ms;
+  }
+  void await_resume() const noexcept {}
+};
+
+// co_await Notecard_Await(req): the transaction itself still blocks, since
+// note-c has no asynchronous API, but the tasks that are due go first
+struct NotecardAwaiter {
+  J *req;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<SensorTask::promise_type> task) const noexcept
+  {
+    task.promise().sleepStartMs = millis();
+    task.promise().sleepMs = 0;
+  }
+  J *await_resume() const { return Notecard_Transaction(req); }
+};
+
+inline SleepAwaiter Sleep_For(unsigned long ms) { return { ms }; }
+inline NotecardAwaiter Notecard_Await(J *req) { return { req }; }
+
+// Executor state. Tasks are resumed in spawn order; frames live in the arena.
+alignas(8) uint8_t coroutineArena[COROUTINE_TASKS][COROUTINE_FRAME_BYTES];
+bool coroutineSlotUsed[COROUTINE_TASKS];
+std::coroutine_handle<SensorTask::promise_type> executorTasks[COROUTINE_TASKS];
+uint8_t executorCount = 0;
+#endif
+
+#if INTERRUPT_CAPTURE
+// Filled by the interrupt handlers, drained by Capture_Drain()
+SpscRing<CaptureEvent, CAPTURE_RING_EVENTS> inaAlertRing;
+SpscRing<CaptureEvent, 4> attnRing;
+bool attnPending = false;  // ATTN fired; commands.qi has notes to apply
+
+// INA260 conversions read since the last report: current, voltage, power
+float captureSum[3][MAX_SENSOR_INSTANCES];
+uint16_t captureCount[MAX_SENSOR_INSTANCES];
+
+// Capture statistics, reset by Report_Cycle()
+unsigned long captureEvents = 0;
+unsigned long captureReads = 0;
+unsigned long captureMaxLatencyUs = 0;  // Longest interrupt-to-drain time
+#endif
+
+// I2C traffic counters, reset by Report_Cycle()
+unsigned long i2cClockHz = I2C_STANDARD_HZ;
+unsigned long i2cTransactions = 0;
+unsigned long i2cBytes = 0;
+unsigned long i2cBusUs = 0;  // Time the bus was busy, from bytes transferred at the current clock
+
+// Local clock disciplined against the Notecard's card.time
+bool clockSynced = false;
+unsigned long clockSyncEpoch = 0;  // Notecard time at the last sync (UTC seconds)
+unsigned long clockSyncMs = 0;  // millis() at the last sync
+unsigned long clockAnchorEpoch = 0;  // Start of the baseline used to estimate drift
+unsigned long clockAnchorMs = 0;
+float clockDriftPpm = 0;  // Estimated millis() drift, positive when millis() runs fast
+float clockDriftErrorPpm = CLOCK_DRIFT_BOUND_PPM;  // Uncertainty of the drift estimate
+
+// Per-request-type Notecard transaction counters
+struct NotecardStats {
+  char req[24];  // Request name, e.g. "card.time"
+  uint16_t count;
+  uint16_t failures;  // No response, or a response carrying "err"
+  unsigned long totalMs;  // Summed round-trip latency
+  unsigned long maxMs;
+  unsigned long bytesSent;
+  unsigned long bytesReceived;
+};
+NotecardStats notecardStats[NOTECARD_STATS_SLOTS];
+
+// Running totals across all request types, never reset, used for per-cycle deltas
+unsigned long notecardTransactions = 0;
+unsigned long notecardBytesSent = 0;
+unsigned long notecardBytesReceived = 0;
+unsigned long notecardFailed = 0;  // Requests that got no response
+unsigned long notecardRejected = 0;  // Requests not sent because the breaker was open
+
+// Circuit breaker. After NOTECARD_BREAKER_FAILURES unanswered requests in a
+// row, requests fail immediately until breakerRetryMs; the next request is
+// then a trial, and another failure reopens the breaker for twice as long.
+uint8_t notecardConsecutiveFailures = 0;
+uint8_t breakerTrips = 0;  // Times opened since the Notecard last answered, 0 = closed
+unsigned long breakerRetryMs = 0;  // millis() after which a trial request is allowed
+uint8_t clockFailures = 0;  // Consecutive failed Clock_Sync() calls before the first sync
+uint8_t notesUnsent = 0;  // Records older than the newest that still need a data note
+
+// Per-cycle benchmark row printed over debug serial
+unsigned long cycleCount = 0;
+unsigned long missedDeadlines = 0;
+
+// Cold boot: the first cycle measures straight away, and hub.sync is only
+// forced if the Notecard cannot give us the time without one
+bool hubSyncPending = true;
+unsigned long firstReadingMs = 0;  // millis() when the first record was stored
+
+#if ENERGY_MODEL
+// Active and idle current per component in mA, from the datasheets
+const float componentActiveMa[COMP_COUNT] = { 10.0, 250.0, 30.0, 100.0, 0.98, 0.31 };
+const float componentIdleMa[COMP_COUNT] = { 10.0, 0.008, 0.0, 0.2, 0.0003, 0.31 };  // MCU busy-waits, INA260 runs continuously
+
+unsigned long cyclePhaseUs[PHASE_COUNT];  // Time spent in each phase this cycle
+unsigned long energyFanOnStartMs = 0;  // pmFanOnMs at the start of the cycle
+unsigned long energyCycleEndMs = 0;  // millis() at the end of the previous cycle
+float energyScale = 1.0;  // Measured / modelled current, from INA260 readings
+float energyCycle_mAh = 0;
+float energyDay_mAh = 0;
+#endif
+
+#if DEBUG && DEBUG_DEFERRED
+// Deferred debug log. A debugPrint() stores a type tag and the raw argument
+// and returns. debugFlush() sends one entry per call from idle time as a
+// binary record, and host/decode_log turns the records back into text, so
+// nothing is formatted on the device. String literals are stored by address
+// and sent as a format ID, with their text only the first time; every other
+// string, char arrays included, is copied, truncated to LOG_TEXT_BYTES,
+// since its contents may change before the flush.
+//
+// A record is a type byte (LogType, plus LOG_NEWLINE), then:
+//   LOG_LITERAL   format ID, 16-bit little-endian
+//   LOG_FORMAT    format ID, then the literal's text
+//   LOG_TEXT      the text
+//   LOG_LONG, LOG_ULONG, LOG_DOUBLE   the value as it is laid out in RAM
+//   LOG_DROPPED   entries lost to a full ring, 16-bit little-endian
+// Each record is COBS-encoded and ends in a zero byte, so a decoder can
+// pick up the stream anywhere.
+enum LogType {
+  LOG_LITERAL,
+  LOG_TEXT,
+  LOG_LONG,
+  LOG_ULONG,
+  LOG_DOUBLE,
+  LOG_FORMAT,  // Only sent: defines a format ID ahead of its first use
+  LOG_DROPPED  // Only sent
+};
+struct LogEntry {
+  uint8_t type;
+  bool newline;
+  union {
+    const char *literal;
+    char text[LOG_TEXT_BYTES];
+    long l;
+    unsigned long ul;
+    double d;
+  } value;
+};
+LogEntry logRing[LOG_ENTRIES];
+uint8_t logHead = 0;  // Next entry to write
+uint8_t logTail = 0;  // Next entry to print
+uint16_t logDropped = 0;  // Entries lost to a full ring since the last flush
+const char *logFormats[LOG_FORMATS];  // Literals sent so far; the index is the format ID
+uint16_t logFormatCount = 0;
+#endif
+
+#if PROFILE
+// Log2 histogram of durations per phase, reset after every health.qo report
+uint16_t phaseHistogram[PHASE_COUNT][PROFILE_BUCKETS];
+unsigned long phaseMaxUs[PHASE_COUNT];
+uint16_t profileCycles = 0;
+const char *const phaseNames[PHASE_COUNT] = {
+  "wait", "mux", "ina260", "pm25aqi", "ahtx0", "location", "send", "jitter"
+};
+#endif
 
 void setup()
 {
-  delay(2000);  // Initial delay to allow peripherals to stabilize
+#if DEBUG
+  delay(2000);  // Give the serial monitor time to attach
+#else
+  while (millis() < BOOT_SETTLE_MS);  // Allow peripherals to stabilize
+#endif
   Serial.begin(115200);  // Initialize serial for debugging
 
   Wire.begin();
@@ -75,116 +743,349 @@ void setup()
   if (myMux.begin() == false)
   {
     debugPrintln("Mux not detected. Freezing...");
-    while (1);
+    while (1) { debugFlush(); }
   }
   debugPrintln("Mux detected");
 
-  // Initialize the AHTX0 sensor (Temperature & Humidity)
-  myMux.setPort(AHTX0_MUX_PORT);
-  if (! aht.begin()) {
+  // Find the sensors on the mux ports; at least one of each type is required
+  Sensors_Discover();
+  if (ahtCount == 0) {
     debugPrintln("Could not find AHTX0 sensor!");
-    while (1);  // Stop the program if the sensor is not found
+    while (1) { debugFlush(); }  // Stop the program if the sensor is not found
   }
-  debugPrintln("AHTX0 found!");
-
-  // Initialize the PM2.5 AQI sensor (Air Quality)
-  myMux.setPort(PM25AQI_MUX_PORT);
-  if (! aqi.begin_I2C()) {     
+  if (aqiCount == 0) {
     debugPrintln("Could not find PM 2.5 sensor!");
-    while (1);  // Stop the program if the sensor is not found
+    while (1) { debugFlush(); }  // Stop the program if the sensor is not found
   }
-  debugPrintln("PM25 found!");
-
-  // Initialize the INA260 sensor (Power, Current, Voltage)
-  myMux.setPort(INA260_MUX_PORT);
-  if (!ina260.begin()) {
+  if (ina260Count == 0) {
     debugPrintln("Couldn't find INA260 sensor!");
-    while (1);  // Stop the program if the sensor is not found
+    while (1) { debugFlush(); }  // Stop the program if the sensor is not found
+  }
+
+#if COROUTINE_READS
+  // A frame that outgrows the arena would drop a reading every cycle, so
+  // stop here instead, where a new build is first run
+  if (!Executor_Check()) {
+    debugPrintln("Coroutine frames do not fit the arena, raise COROUTINE_FRAME_BYTES. Freezing...");
+    while (1) { debugFlush(); }
   }
-  debugPrintln("INA260 found!");
+#endif
 
-  // Set INA260 to average over 16 samples
-  ina260.setAveragingCount(INA260_COUNT_16);
+  debugPrint("Sample record bytes: "); debugPrintln(sizeof(SampleRecord));
+  debugPrint("Sample store bytes: "); debugPrintln(sizeof(SampleStore));
+
+  // Keep the PM2.5 sensors asleep until the first sampling window
+  pinMode(PM25AQI_SET_PIN, OUTPUT);
+  PM25AQI_Sleep();
 
   notecard.begin(Serial1);  // Initialize the Notecard in UART mode
   
-  #if DEBUG
+  #if DEBUG && !DEBUG_DEFERRED  // note-c's tracing would block on the UART, bypassing the deferred log
   notecard.setDebugOutputStream(Serial);  // Set Notecard to output debug info over serial
   #endif
 
-  // Set up the Notecard for hub communication
-  {  
+  // Set up the Notecard for hub communication. The Notecard keeps its
+  // configuration across our resets and brown-outs, so only send hub.set
+  // when hub.get shows something different. hub.get is also the first
+  // request, ahead of any backoff, so it seeds the retry jitter.
+  bool hubConfigured = false;
+  {
+    J *rsp = Notecard_Transaction(notecard.newRequest("hub.get"));
+    Random_Seed(rsp != NULL ? JGetString(rsp, "device") : "");
+    if (rsp != NULL) {
+      hubConfigured = !notecard.responseError(rsp) && strcmp(JGetString(rsp, "product"), productUID) == 0 &&
+                      strcmp(JGetString(rsp, "mode"), "periodic") == 0;
+      NoteDeleteResponse(rsp);
+    }
+  }
+  if (!hubConfigured) {  
     J *req = notecard.newRequest("hub.set");
     JAddStringToObject(req, "product", productUID);
     JAddStringToObject(req, "mode", "periodic");  // periodic communication mode
-    if (!notecard.sendRequest(req)) {
-      JDelete(req);  // Delete the request if sending fails
+    if (!Notecard_Send(req)) {
+      debugPrintln("Failed to configure hub\n");
     }
   }
 
-  // Perform an immediate sync to fetch the current time and update settings
-  {
-    J *req = notecard.newRequest("hub.sync");
-    if (!notecard.sendRequest(req)) {
-      debugPrintln("Failed to perform initial hub sync\n");
-    }
-  }
+  // No initial hub.sync: the first data note syncs anyway, and loop() only
+  // forces one if the Notecard does not know the time yet
+
+  // Pick up any settings already configured in Notehub
+  Config_Poll();
+#if INTERRUPT_CAPTURE
+  Capture_Begin();
+#endif
 
+  // Carry on with a cycle a reset interrupted
+  checkpointRetained = Checkpoint_Retained();
+  if (!checkpointRetained) {
+    debugPrintln("Checkpoint is not in retained RAM, cycles will not resume after a reset");
+  }
+  if (Checkpoint_Restore()) {
+    resumePhase = checkpoint.phase;
+    sample = checkpoint.sample;
+    notesUnsent = checkpoint.notesUnsent;
+    debugPrint("Resuming cycle after checkpoint phase "); debugPrintln(resumePhase);
+  }
 }
 
 void loop()
 {
-  // Fetch the Notecard's current time
-  unsigned long notecardTime = 0;
-  {
-    J *rsp = notecard.requestAndResponse(notecard.newRequest("card.time"));
-    if (rsp != NULL) {
-      notecardTime = JGetInt(rsp, "time");  // Get the Notecard's current timestamp (UTC)
-      NoteDeleteResponse(rsp);
-    } else {
-      debugPrintln("Failed to get Notecard time. Retrying...\n");
-      delay(1000);  // Retry after a delay
-      return;
+  // Read the local clock, only asking the Notecard for the time when the
+  // error bound has grown past what we tolerate
+  unsigned long clockErrorMs = 0;
+  uint64_t nowMs = Clock_Now_Ms(&clockErrorMs);
+  if (!clockSynced || clockErrorMs > CLOCK_MAX_ERROR_MS) {
+    if (!Clock_Sync()) {
+      if (hubSyncPending) {
+        // A factory-fresh or long-unpowered Notecard only learns the time
+        // from a sync
+        J *req = notecard.newRequest("hub.sync");
+        if (Notecard_Send(req)) {
+          hubSyncPending = false;
+        }
+      }
+      if (!clockSynced) {
+        // Nothing to timestamp readings with yet, so back off and retry
+        unsigned long retryMs = Backoff_Ms(clockFailures);
+        if (clockFailures < UINT8_MAX) {
+          clockFailures++;
+        }
+        debugPrint("Failed to get Notecard time. Retrying in ms: "); debugPrintln(retryMs);
+        Acquire_For(retryMs);
+        return;
+      }
+      // Keep sampling on the free-running clock; its error bound keeps
+      // growing until a sync succeeds
+      debugPrintln("Failed to get Notecard time, continuing on the local clock\n");
     }
+    clockFailures = 0;
+    nowMs = Clock_Now_Ms(&clockErrorMs);
   }
 
-  debugPrintln("Waiting until the next 15-minute mark.");
-  // Calculate seconds until the next 15-minute mark
-  unsigned long secondsUntilNextMark = (900 - (notecardTime % 900));  // 900 seconds = 15 minutes
+  debugPrintln("Waiting until the next sampling mark.");
+  // Calculate milliseconds until the next sampling mark (every 15 minutes by default)
+  unsigned long intervalMs = Sample_Interval_Ms(nowMs);
+  unsigned long msUntilNextMark = intervalMs - (unsigned long)(nowMs % intervalMs);
 
-  // Busy wait until the next 15-minute mark
+  // Busy wait until the next sampling mark, waking the PM2.5 sensor early
+  // enough that its fan has warmed up by the time it is sampled. The first
+  // cycle after boot measures straight away instead.
+  PROBE_START(PHASE_WAIT);
   unsigned long startWaitTime = millis();  // Record the start time of waiting
-  unsigned long waitTimeMs = secondsUntilNextMark * 1000;  // Convert to milliseconds
+  unsigned long waitTimeMs = msUntilNextMark + (long)(msUntilNextMark * clockDriftPpm / 1e6);  // Convert to local millis()
+  bool bootCycle = (firstReadingMs == 0);
+  if (bootCycle) {
+    waitTimeMs = 0;
+  }
+  unsigned long warmupMs = (unsigned long)PM25AQI_WARMUP_S * 1000;
+  unsigned long wakeAtMs = (waitTimeMs > warmupMs) ? (waitTimeMs - warmupMs) : 0;
+#if MULTI_RATE
+  // Until the mark, wake for whichever task deadline comes first
+  if (!schedulerStarted) {
+    Scheduler_Start((uint32_t)(nowMs / 1000));
+  }
+  uint32_t nextTaskS = Scheduler_Next();
+#endif
+  bool burst = nowMs < burstUntilMs;
   while (millis() - startWaitTime < waitTimeMs) {
-    // Actively wait for the duration to pass
+    if (millis() - startWaitTime >= wakeAtMs) {
+      PM25AQI_Wake();
+    } else if (!burst && pmWakeMs != 0) {
+      PM25AQI_Sleep();  // A burst has ended and left the fans running
+    }
+    if (syncStartMs != 0 && millis() - syncCheckMs >= SYNC_CHECK_MS) {
+      // Apply what the data note's sync brought in, and start the wait over
+      // if a command changed the cadence
+      syncCheckMs = millis();
+      if (Sync_Completed(syncStartMs) || millis() - syncStartMs >= SYNC_CHECK_TIMEOUT_MS) {
+        syncStartMs = 0;
+        Config_Poll();
+        Command_Poll();
+        if (Sample_Interval_Ms(Clock_Now_Ms(NULL)) != intervalMs) {
+          return;
+        }
+      }
+    }
+#if MULTI_RATE
+    uint32_t taskNowS = (uint32_t)(Clock_Now_Ms(NULL) / 1000);
+    if ((int32_t)(taskNowS - nextTaskS) >= 0) {
+      Scheduler_Run(taskNowS);
+      nextTaskS = Scheduler_Next();
+    }
+#endif
+#if INTERRUPT_CAPTURE
+    Capture_Drain();
+    if (attnPending) {
+      // Apply a command as soon as it arrives rather than after the next
+      // report, and start the wait over if it changed the cadence
+      attnPending = false;
+      Command_Poll();
+      Capture_Arm_Attn();
+      if (Sample_Interval_Ms(Clock_Now_Ms(NULL)) != intervalMs) {
+        return;
+      }
+    }
+#endif
+    debugFlush();
+  }
+  PROBE_STOP(PHASE_WAIT);
+  debugPrintln("Reached the sampling mark. Starting tasks.");
+
+  // Snapshot counters so the cycle can be reported on its own
+  unsigned long cycleStartMs = millis();
+  unsigned long startTransactions = notecardTransactions;
+  unsigned long startBytesSent = notecardBytesSent;
+  unsigned long startBytesReceived = notecardBytesReceived;
+
+  // A checkpoint older than one interval belongs to a cycle that can no
+  // longer be finished on time; start afresh
+  uint32_t cycleEpoch = (uint32_t)(Clock_Now_Ms(NULL) / 1000);
+  if (resumePhase != CHECKPOINT_NONE) {
+    if (cycleEpoch - checkpoint.cycleEpoch > intervalMs / 1000) {
+      resumePhase = CHECKPOINT_NONE;
+    } else {
+      cycleEpoch = checkpoint.cycleEpoch;
+    }
+  }
+
+  // How far from the mark the measurement actually starts
+  unsigned long markOffsetMs = (unsigned long)(Clock_Now_Ms(NULL) % intervalMs);
+  if (markOffsetMs > intervalMs / 2) {
+    markOffsetMs = intervalMs - markOffsetMs;  // Early rather than late
+  }
+#if PROFILE
+  if (!bootCycle) {
+    Profile_Record(PHASE_JITTER, markOffsetMs * 1000);
+  }
+#endif
+
+#if MULTI_RATE
+  Scheduler_Run((uint32_t)(Clock_Now_Ms(NULL) / 1000));  // Tasks due on the mark itself
+#endif
+
+  // Execute tasks on the exact mark, checkpointing after each one. After a
+  // reset the steps the checkpoint already covers are skipped.
+  uint8_t skipPhase = resumePhase;
+  resumePhase = CHECKPOINT_NONE;
+#if COROUTINE_READS
+  // The reads and the location search interleave on the executor, so they
+  // make one step and one checkpoint. Overlapping phases are timed as the
+  // longest of them.
+  if (skipPhase < CHECKPOINT_LOCATION) {
+    bool burst = Clock_Now_Ms(NULL) < burstUntilMs;
+    if (skipPhase < CHECKPOINT_INA260) {
+      Executor_Spawn(Read_INA260());
+    }
+    if (skipPhase < CHECKPOINT_PM25AQI) {
+      Executor_Spawn(Read_PM25AQI());
+    }
+    if (skipPhase < CHECKPOINT_AHTX0) {
+      Executor_Spawn(Read_AHTX0());
+    }
+    if (burst) {
+      sample.time = (uint32_t)(Clock_Now_Ms(NULL) / 1000);  // No GPS search during a burst, as below
+      PROBE(PHASE_PM25AQI, Executor_Run());
+    } else {
+      Executor_Spawn(Notecard_Find_Location());
+      PROBE(PHASE_LOCATION, Executor_Run());
+    }
+    Checkpoint_Save(CHECKPOINT_LOCATION, cycleEpoch);
+  }
+#else
+  if (skipPhase < CHECKPOINT_INA260) {
+    PROBE(PHASE_INA260, Read_INA260());
+    Checkpoint_Save(CHECKPOINT_INA260, cycleEpoch);
   }
-  debugPrintln("Reached the 15-minute mark. Starting tasks.");
+  if (skipPhase < CHECKPOINT_PM25AQI) {
+    PROBE(PHASE_PM25AQI, Read_PM25AQI());
+    Checkpoint_Save(CHECKPOINT_PM25AQI, cycleEpoch);
+  }
+  if (skipPhase < CHECKPOINT_AHTX0) {
+    PROBE(PHASE_AHTX0, Read_AHTX0());
+    Checkpoint_Save(CHECKPOINT_AHTX0, cycleEpoch);
+  }
+  if (skipPhase < CHECKPOINT_LOCATION) {
+    if (Clock_Now_Ms(NULL) < burstUntilMs) {
+      // No GPS search during a burst; it would outlast the cadence and the
+      // station has not moved, so keep the last fix and stamp the local clock
+      sample.time = (uint32_t)(Clock_Now_Ms(NULL) / 1000);
+    } else {
+      PROBE(PHASE_LOCATION, Notecard_Find_Location());
+    }
+    Checkpoint_Save(CHECKPOINT_LOCATION, cycleEpoch);
+  }
+#endif
+#if HIGH_RATE_ACQUISITION
+  // Only when Read_INA260() started the decimators this cycle; captured or
+  // task means are already final, and a resumed cycle skipped the step
+  if (inaDecimating) {
+    Acquire_Finish();
+    inaDecimating = false;
+  }
+#endif
+  Store_Push(&sample);
+  if (firstReadingMs == 0) {
+    firstReadingMs = millis();
+    debugPrint("Time to first reading (ms): "); debugPrintln(firstReadingMs);
+  }
+#if BINARY_UPLOAD
+  if (Clock_Now_Ms(NULL) < burstUntilMs) {
+    // Burst records go out a block at a time instead of one note each
+    if (++binaryPending >= BINARY_BLOCK_RECORDS && Binary_Upload(0, binaryPending)) {
+      binaryPending = 0;
+    }
+  } else {
+    // Flush what is left of a burst, then report the new record as usual
+    if (binaryPending > 0 && Binary_Upload(1, binaryPending)) {
+      binaryPending = 0;
+    }
+    PROBE(PHASE_SEND, Send_Data());
+  }
+#else
+  PROBE(PHASE_SEND, Send_Data());
+#endif
+  Checkpoint_Save(CHECKPOINT_NONE, cycleEpoch);  // Cycle finished
+
+#if ENERGY_MODEL
+  Energy_Update(millis() - energyCycleEndMs);
+  energyCycleEndMs = millis();
+#endif
 
-  // Execute tasks on the exact mark
-  myMux.setPort(INA260_MUX_PORT);
-  Read_INA260();
-  myMux.setPort(PM25AQI_MUX_PORT);
-  Read_PM25AQI();
-  myMux.setPort(AHTX0_MUX_PORT);
-  Read_AHTX0();
-  Notecard_Find_Location();
-  Send_Data();
+  // A cycle misses its deadline if it started late or ran into the next mark
+  unsigned long awakeMs = millis() - cycleStartMs;
+  Report_Cycle(awakeMs, notecardTransactions - startTransactions, notecardBytesSent - startBytesSent,
+               notecardBytesReceived - startBytesReceived,
+               !bootCycle && (markOffsetMs > CYCLE_DEADLINE_MS || awakeMs >= intervalMs));
+
+#if PROFILE
+  if (++profileCycles >= PROFILE_REPORT_CYCLES) {
+    Send_Health();
+  }
+#endif
 }
 
-void Notecard_Find_Location()
+READ_TASK Notecard_Find_Location()
 {
   size_t gps_time_s = 0;
-  const size_t timeout_s = 600;  // 10-minute timeout for finding a location
+  const size_t timeout_s = config.gpsTimeoutS;  // 10-minute timeout for finding a location by default
+
+  // Stamp the local clock until a fix supplies its own time, and keep the
+  // last position; with the breaker open there is no point searching
+  sample.time = (uint32_t)(Clock_Now_Ms(NULL) / 1000);
+  if (Notecard_Breaker_Open()) {
+    READ_RETURN;
+  }
 
   // Fetch the current location time
   {
-    J *rsp = notecard.requestAndResponse(notecard.newRequest("card.location"));
+    J *rsp = READ_REQUEST(notecard.newRequest("card.location"));
     if (rsp != NULL) {
       gps_time_s = JGetInt(rsp, "time");  // Get the GPS time
       NoteDeleteResponse(rsp);
     } else {
       debugPrintln("Failed to fetch initial location time\n");
-      return;  // Exit if we can't fetch the initial GPS time
+      READ_RETURN;  // Exit if we can't fetch the initial GPS time
     }
   }
 
@@ -193,9 +1094,9 @@ void Notecard_Find_Location()
     J *req = notecard.newRequest("card.location.mode");
     if (req != NULL) {
       JAddStringToObject(req, "mode", "continuous");
-      if (!notecard.sendRequest(req)) {
+      if (!Notecard_Send(req)) {
         debugPrintln("Failed to switch to continuous mode\n");
-        return;  // Exit if the mode change fails
+        READ_RETURN;  // Exit if the mode change fails
       }
     }
   }
@@ -206,19 +1107,12 @@ void Notecard_Find_Location()
     if (::millis() >= (start_ms + (timeout_s * 1000))) {
       debugPrintln("Timed out looking for a location\n");
 
-      // Set time before exiting
-      J *rsp = notecard.requestAndResponse(notecard.newRequest("card.time"));
-      if (rsp != NULL) {
-        Set_Time_Location(rsp);
-        NoteDeleteResponse(rsp);
-      }
-
       SetNotecardToOffMode();  // Ensure system is returned to off mode
       break;
     }
 
     // Fetch current location data
-    J *rsp = notecard.requestAndResponse(notecard.newRequest("card.location"));
+    J *rsp = READ_REQUEST(notecard.newRequest("card.location"));
     if (rsp != NULL) {
       if (JGetInt(rsp, "time") != gps_time_s) {
         // Location updated, process new data
@@ -240,7 +1134,171 @@ void Notecard_Find_Location()
       NoteDeleteResponse(rsp);  // Clean up response
     }
 
-    delay(2000);  // Wait 2 seconds before polling again
+    READ_SLEEP(2000);  // Wait 2 seconds before polling again
+  }
+}
+
+J *Notecard_Transaction(J *req)
+{
+  // requestAndResponse() with per-request-type latency, size and failure accounting
+  if (req == NULL) {
+    return NULL;
+  }
+  if (Notecard_Breaker_Open()) {
+    JDelete(req);
+    notecardRejected++;
+    return NULL;
+  }
+
+  // Find (or claim) the counter slot for this request type
+  const char *name = JGetString(req, "req");
+  NotecardStats *stats = &notecardStats[NOTECARD_STATS_SLOTS - 1];
+  for (uint8_t i = 0; i < NOTECARD_STATS_SLOTS; i++) {
+    if (notecardStats[i].req[0] == '\0') {
+      strncpy(notecardStats[i].req, name, sizeof(notecardStats[i].req) - 1);
+      stats = &notecardStats[i];
+      break;
+    }
+    if (strncmp(notecardStats[i].req, name, sizeof(notecardStats[i].req) - 1) == 0) {
+      stats = &notecardStats[i];
+      break;
+    }
+  }
+
+#if PROFILE || DEBUG
+  // Size the request as it goes over the wire (JSON plus newline). This
+  // serializes every request a second time, so release builds skip it.
+  char *json = JPrintUnformatted(req);
+  if (json != NULL) {
+    stats->bytesSent += strlen(json) + 1;
+    notecardBytesSent += strlen(json) + 1;
+    JFree(json);
+  }
+#endif
+
+  unsigned long startMs = millis();
+  J *rsp = notecard.requestAndResponse(req);
+  unsigned long elapsedMs = millis() - startMs;
+
+  stats->count++;
+  notecardTransactions++;
+  stats->totalMs += elapsedMs;
+  if (elapsedMs > stats->maxMs) {
+    stats->maxMs = elapsedMs;
+  }
+  if (rsp == NULL || notecard.responseError(rsp)) {
+    stats->failures++;
+  }
+
+  // Only silence counts against the breaker; an "err" reply means the
+  // Notecard itself is alive
+  if (rsp == NULL) {
+    notecardFailed++;
+    if (breakerTrips > 0 || ++notecardConsecutiveFailures >= NOTECARD_BREAKER_FAILURES) {
+      breakerRetryMs = millis() + Backoff_Ms(breakerTrips);
+      if (breakerTrips < UINT8_MAX) {
+        breakerTrips++;
+      }
+      notecardConsecutiveFailures = 0;
+      debugPrint("Notecard breaker open, trips: "); debugPrintln(breakerTrips);
+    }
+  } else {
+    notecardConsecutiveFailures = 0;
+    if (breakerTrips > 0) {
+      breakerTrips = 0;
+      debugPrintln("Notecard breaker closed");
+    }
+  }
+#if PROFILE || DEBUG
+  if (rsp != NULL) {
+    json = JPrintUnformatted(rsp);
+    if (json != NULL) {
+      stats->bytesReceived += strlen(json) + 1;
+      notecardBytesReceived += strlen(json) + 1;
+      JFree(json);
+    }
+  }
+#endif
+  return rsp;
+}
+
+bool Notecard_Breaker_Open()
+{
+  return breakerTrips > 0 && (long)(millis() - breakerRetryMs) < 0;
+}
+
+unsigned long Backoff_Ms(uint8_t attempt)
+{
+  // Capped exponential backoff with equal jitter: half the delay is fixed
+  // and half random, so stations that lost the network together do not
+  // all retry together
+  unsigned long ms = NOTECARD_BACKOFF_MAX_MS;
+  if (attempt < 20 && (NOTECARD_BACKOFF_BASE_MS << attempt) < NOTECARD_BACKOFF_MAX_MS) {
+    ms = NOTECARD_BACKOFF_BASE_MS << attempt;
+  }
+  return ms / 2 + random(ms / 2 + 1);
+}
+
+void Random_Seed(const char *deviceUID)
+{
+  // Seed random() from something unique to this unit. Unseeded, every
+  // station draws the same jitter sequence and Backoff_Ms() would retry
+  // them in step after all of them lost the network together. The STM32's
+  // factory 96-bit UID is always there; other cores use the Notecard's
+  // DeviceUID, and stay unseeded if hub.get went unanswered.
+#if defined(ARDUINO_ARCH_STM32)
+  (void)deviceUID;
+  uint32_t crc = Crc32(0xFFFFFFFF, (const void *)UID_BASE, 12);
+#else
+  if (deviceUID[0] == '\0') {
+    return;
+  }
+  uint32_t crc = Crc32(0xFFFFFFFF, deviceUID, strlen(deviceUID));
+#endif
+  randomSeed(crc ^ 0xFFFFFFFF);
+}
+
+bool Notecard_Send(J *req)
+{
+  // sendRequest() equivalent that goes through the transaction accounting
+  J *rsp = Notecard_Transaction(req);
+  bool success = (rsp != NULL && !notecard.responseError(rsp));
+  if (rsp != NULL) {
+    NoteDeleteResponse(rsp);
+  }
+  return success;
+}
+
+void Notecard_Report_Stats(J *body)
+{
+  // Add the transaction counters to a note body and echo them to debug serial
+  J *stats = JAddObjectToObject(body, "notecard");
+  if (stats) {
+    JAddNumberToObject(stats, "failed", notecardFailed);
+    JAddNumberToObject(stats, "rejected", notecardRejected);
+  }
+  for (uint8_t i = 0; i < NOTECARD_STATS_SLOTS && notecardStats[i].req[0] != '\0'; i++) {
+    NotecardStats *s = &notecardStats[i];
+    if (stats) {
+      J *entry = JAddObjectToObject(stats, s->req);
+      if (entry) {
+        JAddNumberToObject(entry, "n", s->count);
+        JAddNumberToObject(entry, "fail", s->failures);
+        JAddNumberToObject(entry, "ms", s->totalMs);
+        JAddNumberToObject(entry, "max_ms", s->maxMs);
+        JAddNumberToObject(entry, "tx", s->bytesSent);
+        JAddNumberToObject(entry, "rx", s->bytesReceived);
+      }
+    }
+
+    debugPrint(s->req);
+    debugPrint(": n="); debugPrint(s->count);
+    debugPrint(" fail="); debugPrint(s->failures);
+    debugPrint(" ms="); debugPrint(s->totalMs);
+    debugPrint(" max_ms="); debugPrint(s->maxMs);
+    debugPrint(" tx="); debugPrint(s->bytesSent);
+    debugPrint(" rx="); debugPrintln(s->bytesReceived);
+    debugDrain();  // All the rows together are more than the log ring holds
   }
 }
 
@@ -248,7 +1306,7 @@ void SetNotecardToOffMode() {
   J *req = notecard.newRequest("card.location.mode");
   if (req != NULL) {
     JAddStringToObject(req, "mode", "off");
-    if (!notecard.sendRequest(req)) {
+    if (!Notecard_Send(req)) {
       debugPrintln("Failed to set Notecard to off mode\n");
     }
   } else {
@@ -256,247 +1314,1997 @@ void SetNotecardToOffMode() {
   }
 }
 
-void Read_AHTX0()
+READ_TASK Read_AHTX0()
 {
-  float temperatureSum = 0;
-  float humiditySum = 0;
-  const int numReadings = 10;
+#if MULTI_RATE
+  // The AHTX0 task has been sampling since the last report; only read here
+  // until it has run
+  if (Task_Store_AHTX0()) {
+    debugPrint("Task Temperature: "); debugPrintln(sample.temperature[0] / 100.0);
+    READ_RETURN;
+  }
+#endif
+
+  float temperatureSum[MAX_SENSOR_INSTANCES] = {0};
+  float humiditySum[MAX_SENSOR_INSTANCES] = {0};
+  const int numReadings = config.numReadings;
 
   for (int i = 0; i < numReadings; i++)
   {
-    // Read temperature and humidity from AHTX0 sensor
-    sensors_event_t humid, temp;
-    aht.getEvent(&humid, &temp);
-
-    temperatureSum += temp.temperature;
-    humiditySum += humid.relative_humidity;
+    // Read temperature and humidity from every AHTX0 sensor in turn
+    for (uint8_t k = 0; k < ahtCount; k++) {
+      PROBE(PHASE_MUX, Mux_Select(ahtPorts[k]));
+      sensors_event_t humid, temp;
+      aht[k].getEvent(&humid, &temp);
+      I2C_Account(2, 9);  // 3-byte trigger command write, then status and 5 data bytes read
+
+      temperatureSum[k] += temp.temperature;
+      humiditySum[k] += humid.relative_humidity;
+    }
 
-    // Wait 500ms before the next reading
-    delay(500);
+    // Wait before the next reading
+    READ_SLEEP(config.spacingMs);
   }
 
-  // Calculate averages
-  float temperatureAvg = temperatureSum / numReadings;
-  float humidityAvg = humiditySum / numReadings;
-
-  // Store the averaged values in global variables
-  temperature = temperatureAvg;
-  temperature = round(temperature * pow(10, 2)) / pow(10, 2);  // Truncate longitude to 2 decimal places
-  humidity = humidityAvg;
-  humidity = round(humidity * pow(10, 2)) / pow(10, 2);  // Truncate longitude to 2 decimal places
+  // Store the averages in the sample record, to 2 decimal places
+  for (uint8_t k = 0; k < ahtCount; k++) {
+    sample.temperature[k] = Fixed(temperatureSum[k] / numReadings, 100, INT16_MIN, INT16_MAX);
+    sample.humidity[k] = Fixed(humiditySum[k] / numReadings, 100, 0, UINT16_MAX);
+  }
 
   // Debug output
   debugPrint("Averaged Temperature: ");
-  debugPrintln(temperature);
+  debugPrintln(sample.temperature[0] / 100.0);
   debugPrint("Averaged Humidity: ");
-  debugPrintln(humidity);
+  debugPrintln(sample.humidity[0] / 100.0);
 }
 
-void Read_INA260()
+READ_TASK Read_INA260()
 {
-  float currentSum = 0;
-  float voltageSum = 0;
-  float powerSum = 0;
-  const int numReadings = 10;
+  inaIntervalMean = false;
+#if INTERRUPT_CAPTURE
+  // Every conversion since the last report has been captured already
+  if (Capture_Store_INA260()) {
+    inaIntervalMean = true;
+    debugPrint("Captured Current: "); debugPrintln(sample.current[0]);
+    READ_RETURN;
+  }
+#endif
+#if MULTI_RATE
+  // The INA260 task has been sampling since the last report; only read here
+  // until it has run
+  if (Task_Store_INA260()) {
+    inaIntervalMean = true;
+    debugPrint("Task Current: "); debugPrintln(sample.current[0]);
+    READ_RETURN;
+  }
+#endif
+
+  const int numReadings = config.numReadings;
+
+#if HIGH_RATE_ACQUISITION
+  // Start decimating; READ_SLEEP() keeps feeding these for the rest of the
+  // awake window. The values stored here are provisional, loop() stores the
+  // full-window result before the record is pushed.
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    Decimator_Reset(&inaCurrentDecimator[k]);
+    Decimator_Reset(&inaVoltageDecimator[k]);
+    Decimator_Reset(&inaPowerDecimator[k]);
+  }
+  highRateSamples = 0;
+  inaDecimating = true;
+  READ_SLEEP(numReadings * config.spacingMs);
+  Acquire_Finish();
+#else
+  float currentSum[MAX_SENSOR_INSTANCES] = {0};
+  float voltageSum[MAX_SENSOR_INSTANCES] = {0};
+  float powerSum[MAX_SENSOR_INSTANCES] = {0};
 
   for (int i = 0; i < numReadings; i++)
   {
-    // Read current, voltage, and power from INA260 sensor
-    currentSum += ina260.readCurrent();
-    voltageSum += ina260.readBusVoltage();
-    powerSum += ina260.readPower();
+    for (uint8_t k = 0; k < ina260Count; k++) {
+      float currentMa, voltageMv;
+      if (INA260_Read(k, &currentMa, &voltageMv)) {
+        currentSum[k] += currentMa;
+        voltageSum[k] += voltageMv;
+        powerSum[k] += fabs(currentMa) * voltageMv / 1000.0;
+      }
+    }
 
-    // Wait 500ms before the next reading
-    delay(500);
+    // Wait before the next reading
+    READ_SLEEP(config.spacingMs);
   }
 
-  // Calculate averages
-  float currentAvg = currentSum / numReadings;
-  float voltageAvg = voltageSum / numReadings;
-  float powerAvg = powerSum / numReadings;
-
-  // Optionally store the averaged values in global variables or print them
-  current = currentAvg;
-  voltage = voltageAvg;
-  power = powerAvg;
+  // Store the averages in the sample record
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    sample.current[k] = Fixed(currentSum[k] / numReadings, 1, INT16_MIN, INT16_MAX);
+    sample.voltage[k] = Fixed(voltageSum[k] / numReadings, 1, 0, UINT16_MAX);
+    sample.power[k] = Fixed(powerSum[k] / numReadings, 1, 0, UINT16_MAX);
+  }
+#endif
 
   // Debug output
-  debugPrint("Averaged Current: "); 
-  debugPrintln(currentAvg);
-  debugPrint("Averaged Voltage: "); 
-  debugPrintln(voltageAvg);
-  debugPrint("Averaged Power: "); 
-  debugPrintln(powerAvg);
+  debugPrint("Averaged Current: ");
+  debugPrintln(sample.current[0]);
+  debugPrint("Averaged Voltage: ");
+  debugPrintln(sample.voltage[0]);
+  debugPrint("Averaged Power: ");
+  debugPrintln(sample.power[0]);
 }
 
-void Read_PM25AQI()
+READ_TASK Read_PM25AQI()
 {
   PM25_AQI_Data data;
 
-  // Variables to accumulate values for averaging
-  float pm10StandardSum = 0, pm25StandardSum = 0, pm100StandardSum = 0;
-  float pm10EnvSum = 0, pm25EnvSum = 0, pm100EnvSum = 0;
-  float particles03umSum = 0, particles05umSum = 0, particles10umSum = 0;
-  float particles25umSum = 0, particles50umSum = 0, particles100umSum = 0;
+  // Variables to accumulate values for averaging, in pmFieldNames order
+  float pmSum[MAX_SENSOR_INSTANCES][PM_FIELDS] = {{0}};
 
-  const int numReadings = 10;
+  const int numReadings = config.numReadings;
 
-  for (int i = 0; i < numReadings; i++) {
-    if (aqi.read(&data)) {
-      // Accumulate values
-      pm10StandardSum += data.pm10_standard;
-      pm25StandardSum += data.pm25_standard;
-      pm100StandardSum += data.pm100_standard;
-
-      pm10EnvSum += data.pm10_env;
-      pm25EnvSum += data.pm25_env;
-      pm100EnvSum += data.pm100_env;
-
-      particles03umSum += data.particles_03um;
-      particles05umSum += data.particles_05um;
-      particles10umSum += data.particles_10um;
-      particles25umSum += data.particles_25um;
-      particles50umSum += data.particles_50um;
-      particles100umSum += data.particles_100um;
-    } else {
-      debugPrintln("Failed to read from PM2.5 sensor!");
+  // Make sure the sensors are awake, then throw away frames until the fans
+  // have been running for the full warm-up interval
+  PM25AQI_Wake();
+  while (millis() - pmWakeMs < (unsigned long)PM25AQI_WARMUP_S * 1000) {
+    for (uint8_t k = 0; k < aqiCount; k++) {
+      PROBE(PHASE_MUX, Mux_Select(aqiPorts[k]));
+      I2C_Account(1, 32);
+      if (aqi[k].read(&data)) {
+        pmFramesDiscarded++;
+      }
     }
-
-    // Wait 500ms before the next reading
-    delay(500);
+    READ_SLEEP(500);
   }
 
-  // Calculate averages
-  float pm10StandardAvg = pm10StandardSum / numReadings;
-  float pm25StandardAvg = pm25StandardSum / numReadings;
-  float pm100StandardAvg = pm100StandardSum / numReadings;
-
-  float pm10EnvAvg = pm10EnvSum / numReadings;
-  float pm25EnvAvg = pm25EnvSum / numReadings;
-  float pm100EnvAvg = pm100EnvSum / numReadings;
-
-  float particles03umAvg = particles03umSum / numReadings;
-  float particles05umAvg = particles05umSum / numReadings;
-  float particles10umAvg = particles10umSum / numReadings;
-  float particles25umAvg = particles25umSum / numReadings;
-  float particles50umAvg = particles50umSum / numReadings;
-  float particles100umAvg = particles100umSum / numReadings;
+#if HIGH_RATE_ACQUISITION
+  // Let READ_SLEEP() average every new frame from every sensor for the
+  // length of the usual sampling window
+  memset(pmBoxcarSum, 0, sizeof(pmBoxcarSum));
+  memset(pmBoxcarFrames, 0, sizeof(pmBoxcarFrames));
+  memset(pmLastChecksum, 0, sizeof(pmLastChecksum));
+  pmAcquiring = true;
+  READ_SLEEP(numReadings * config.spacingMs);
+  pmAcquiring = false;
+  for (uint8_t k = 0; k < aqiCount; k++) {
+    for (uint8_t f = 0; pmBoxcarFrames[k] > 0 && f < PM_FIELDS; f++) {
+      pmSum[k][f] = pmBoxcarSum[k][f] / pmBoxcarFrames[k] * numReadings;
+    }
+  }
+#else
+  float fields[PM_FIELDS];
+  for (int i = 0; i < numReadings; i++) {
+    for (uint8_t k = 0; k < aqiCount; k++) {
+      PROBE(PHASE_MUX, Mux_Select(aqiPorts[k]));
+      I2C_Account(1, 32);  // One 32-byte frame read
+      if (aqi[k].read(&data)) {
+        // Accumulate values
+        PM25AQI_Fields(&data, fields);
+        for (uint8_t f = 0; f < PM_FIELDS; f++) {
+          pmSum[k][f] += fields[f];
+        }
+      } else {
+        debugPrintln("Failed to read from PM2.5 sensor!");
+      }
+    }
 
-  // Store averages into variables
-  pm10_standard = pm10StandardAvg;
-  pm25_standard = pm25StandardAvg;
-  pm100_standard = pm100StandardAvg;
+    // Wait before the next reading
+    READ_SLEEP(config.spacingMs);
+  }
+#endif
 
-  pm10_env = pm10EnvAvg;
-  pm25_env = pm25EnvAvg;
-  pm100_env = pm100EnvAvg;
+  // Sampling window is over, stop the fans until the next cycle. During a
+  // burst the next window is too close for a sleep and warm-up.
+  if (Clock_Now_Ms(NULL) >= burstUntilMs) {
+    PM25AQI_Sleep();
+  }
 
-  // Convert float averages to uint16_t with rounding
-  particles_03um = (uint16_t)round(particles03umAvg);
-  particles_05um = (uint16_t)round(particles05umAvg);
-  particles_10um = (uint16_t)round(particles10umAvg);
-  particles_25um = (uint16_t)round(particles25umAvg);
-  particles_50um = (uint16_t)round(particles50umAvg);
-  particles_100um = (uint16_t)round(particles100umAvg);
+  // Store the averages in the sample record
+  for (uint8_t k = 0; k < aqiCount; k++) {
+    for (uint8_t f = 0; f < PM_FIELDS; f++) {
+      sample.pm[k][f] = Fixed(pmSum[k][f] / numReadings, pmFieldScale[f], 0, UINT16_MAX);
+    }
+  }
 
   // Debug output
-  debugPrint("Averaged PM10 (standard): "); debugPrintln(pm10_standard);
-  debugPrint("Averaged PM2.5 (standard): "); debugPrintln(pm25_standard);
-  debugPrint("Averaged PM100 (standard): "); debugPrintln(pm100_standard);
-
-  debugPrint("Averaged PM10 (environmental): "); debugPrintln(pm10_env);
-  debugPrint("Averaged PM2.5 (environmental): "); debugPrintln(pm25_env);
-  debugPrint("Averaged PM100 (environmental): "); debugPrintln(pm100_env);
+  for (uint8_t f = 0; f < PM_FIELDS; f++) {
+    debugPrint("Averaged "); debugPrint(pmFieldNames[f]); debugPrint(": ");
+    debugPrintln(sample.pm[0][f] / pmFieldScale[f]);
+  }
 
-  debugPrint("Averaged Particles > 0.3um: "); debugPrintln(particles_03um);
-  debugPrint("Averaged Particles > 0.5um: "); debugPrintln(particles_05um);
-  debugPrint("Averaged Particles > 1.0um: "); debugPrintln(particles_10um);
-  debugPrint("Averaged Particles > 2.5um: "); debugPrintln(particles_25um);
-  debugPrint("Averaged Particles > 5.0um: "); debugPrintln(particles_50um);
-  debugPrint("Averaged Particles > 50um: "); debugPrintln(particles_100um);
+  // Fan-on time saved per day compared to running the sensor continuously
+  unsigned long uptimeMs = millis();
+  if (uptimeMs > 0) {
+    float savedSecondsPerDay = 86400.0 * (1.0 - (float)pmFanOnMs / uptimeMs);
+    debugPrint("PM fan-on time saved per day (s): "); debugPrintln(savedSecondsPerDay);
+    debugPrint("PM frames discarded during warm-up: "); debugPrintln(pmFramesDiscarded);
+  }
 }
 
-void Set_Time_Location(J *rsp)
+bool INA260_Read(uint8_t k, float *currentMa, float *voltageMv)
 {
-  // Parse and set the time and location from the Notecard response
-  time_t rawtime;
-  rawtime = JGetNumber(rsp, "time");  
-
-  lon = JGetNumber(rsp, "lon"); 
-  lat = JGetNumber(rsp, "lat");
-
-  struct tm  ts;  
-  ts = *localtime(&rawtime);  // Convert raw time to local time
-  strftime(yyyy, sizeof(yyyy), "%Y", &ts); 
-  strftime(mM, sizeof(mM), "%m", &ts); 
-  strftime(dd, sizeof(dd), "%d", &ts); 
-  strftime(hh, sizeof(hh), "%H", &ts); 
-  strftime(ss, sizeof(ss), "%S", &ts); 
-  strftime(mm, sizeof(mm), "%M", &ts); 
+  // Read current and voltage straight from the INA260 registers. The
+  // INA260 does not auto-increment its register pointer, so each register
+  // needs its own transaction; power is computed from the same conversion
+  // (the chip's power register is I x V) instead of spending a third read.
+  PROBE(PHASE_MUX, Mux_Select(ina260Ports[k]));
+  uint8_t raw[2];
+  if (!I2C_Read_Registers(INA260_I2C_ADDR, INA260_REG_CURRENT, raw, 2)) {
+    return false;
+  }
+  *currentMa = (int16_t)((raw[0] << 8) | raw[1]) * 1.25;
+  if (!I2C_Read_Registers(INA260_I2C_ADDR, INA260_REG_BUS_VOLTAGE, raw, 2)) {
+    return false;
+  }
+  *voltageMv = (uint16_t)((raw[0] << 8) | raw[1]) * 1.25;
+  return true;
 }
 
-void Send_Data()
+void PM25AQI_Fields(const PM25_AQI_Data *data, float *fields)
 {
-  // Create a Notecard request to send sensor data
-  J *req = notecard.newRequest("note.add");  
-  if (req != NULL)
-  {
-    JAddStringToObject(req, "file", "data.qo");  // Store data in "sensors.qo" file
-    JAddBoolToObject(req, "sync", true);  // Request immediate sync
-    J *body = JAddObjectToObject(req, "body");
-    if (body)
-    {
-      // Add time and location data
-      JAddStringToObject(body, "YYYY", yyyy);
-      JAddStringToObject(body, "MM", mM);
-      JAddStringToObject(body, "DD", dd);  
-      JAddStringToObject(body, "hh", hh);
-      JAddStringToObject(body, "mm", mm);
-      JAddStringToObject(body, "ss", ss);
-      JAddNumberToObject(body, "lat", lat);            
-      JAddNumberToObject(body, "lon", lon);   
-
-      // Add sensor data for temperature and humidity
-      JAddNumberToObject(body, "temperature", temperature);  // Temperature
-      JAddNumberToObject(body, "humidity", humidity);  // Humidity
-
-      // Add PM2.5 AQI sensor data
-      JAddNumberToObject(body, "pm10_standard", pm10_standard);  // PM10 (standard)
-      JAddNumberToObject(body, "pm25_standard", pm25_standard);  // PM2.5 (standard)
-      JAddNumberToObject(body, "pm100_standard", pm100_standard);  // PM100 (standard)
-      JAddNumberToObject(body, "pm10_env", pm10_env);  // PM10 (environmental)
-      JAddNumberToObject(body, "pm25_env", pm25_env);  // PM2.5 (environmental)
-      JAddNumberToObject(body, "pm100_env", pm100_env);  // PM100 (environmental)
-
-      // Add particle counts for various sizes
-      JAddNumberToObject(body, "particles_03um", particles_03um);  // Particles > 0.3um
-      JAddNumberToObject(body, "particles_05um", particles_05um);  // Particles > 0.5um
-      JAddNumberToObject(body, "particles_10um", particles_10um);  // Particles > 1.0um
-      JAddNumberToObject(body, "particles_25um", particles_25um);  // Particles > 2.5um
-      JAddNumberToObject(body, "particles_50um", particles_50um);  // Particles > 5.0um
-      JAddNumberToObject(body, "particles_100um", particles_100um);  // Particles > 50um
+  // Unpack a frame into pmFieldNames order
+  fields[0] = data->pm10_standard;
+  fields[1] = data->pm25_standard;
+  fields[2] = data->pm100_standard;
+
+  fields[3] = data->pm10_env;
+  fields[4] = data->pm25_env;
+  fields[5] = data->pm100_env;
+
+  fields[6] = data->particles_03um;
+  fields[7] = data->particles_05um;
+  fields[8] = data->particles_10um;
+  fields[9] = data->particles_25um;
+  fields[10] = data->particles_50um;
+  fields[11] = data->particles_100um;
+}
 
-      // Add INA260 sensor data (current, voltage, power)
-      JAddNumberToObject(body, "current", current);  // Current
-      JAddNumberToObject(body, "voltage", voltage);  // Voltage
-      JAddNumberToObject(body, "power", power);  // Power
+void Acquire_For(unsigned long ms)
+{
+  // Stand-in for delay() inside the awake window. In high-rate mode the time
+  // is spent reading the INA260s back to back and every new PM2.5 frame,
+  // feeding the INA260 decimators and the PM boxcar; otherwise it simply waits.
+  // Either way the deferred debug log is printed in between.
+#if HIGH_RATE_ACQUISITION
+  uint8_t returnPort = muxPort;
+  unsigned long startMs = millis();
+  while (millis() - startMs < ms) {
+#if INTERRUPT_CAPTURE
+    Capture_Drain();
+#endif
+    for (uint8_t k = 0; k < ina260Count; k++) {
+      float currentMa, voltageMv;
+      if (INA260_Read(k, &currentMa, &voltageMv)) {
+        Decimator_Add(&inaCurrentDecimator[k], lround(currentMa * 10));
+        Decimator_Add(&inaVoltageDecimator[k], lround(voltageMv));
+        Decimator_Add(&inaPowerDecimator[k], lround(fabs(currentMa) * voltageMv / 1000.0));
+        highRateSamples++;
+      }
     }
 
-    notecard.sendRequest(req);  // Send the request to the Notecard
+    for (uint8_t k = 0; pmAcquiring && k < aqiCount; k++) {
+      PM25_AQI_Data data;
+      PROBE(PHASE_MUX, Mux_Select(aqiPorts[k]));
+      I2C_Account(1, 32);
+      if (aqi[k].read(&data) && data.checksum != pmLastChecksum[k]) {
+        pmLastChecksum[k] = data.checksum;
+        float fields[PM_FIELDS];
+        PM25AQI_Fields(&data, fields);
+        for (uint8_t f = 0; f < PM_FIELDS; f++) {
+          pmBoxcarSum[k][f] += fields[f];
+        }
+        pmBoxcarFrames[k]++;
+      }
+    }
+    debugFlush();  // One entry per pass, so the log drains while the sensors are polled
   }
+  Mux_Select(returnPort);
+#else
+  // Nothing to sample, so use the time to print deferred debug output
+  unsigned long startMs = millis();
+  do {
+#if INTERRUPT_CAPTURE
+    Capture_Drain();
+#endif
+    debugFlush();
+  } while (millis() - startMs < ms);
+#endif
 }
 
-template <typename T>
-void debugPrint(T message) {
+#if HIGH_RATE_ACQUISITION
+void Acquire_Finish()
+{
+  // Store the INA260 averages decimated over the awake window so far
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    sample.current[k] = Fixed(Decimator_Mean(&inaCurrentDecimator[k]), 0.1, INT16_MIN, INT16_MAX);
+    sample.voltage[k] = Fixed(Decimator_Mean(&inaVoltageDecimator[k]), 1, 0, UINT16_MAX);
+    sample.power[k] = Fixed(Decimator_Mean(&inaPowerDecimator[k]), 1, 0, UINT16_MAX);
+  }
+  debugPrint("High-rate INA260 samples: "); debugPrintln(highRateSamples);
+}
+#endif
+
+void Decimator_Reset(Decimator *d)
+{
+  memset(d, 0, sizeof(*d));
+}
+
+void Decimator_Add(Decimator *d, int32_t x)
+{
+  d->rawSum += x;
+  d->rawCount++;
+
+  // Integrator stages
+  uint32_t acc = (uint32_t)x;
+  for (uint8_t n = 0; n < DECIMATION_ORDER; n++) {
+    d->integrator[n] += acc;
+    acc = d->integrator[n];
+  }
+  if (++d->phase < DECIMATION_FACTOR) {
+    return;
+  }
+  d->phase = 0;
+
+  // Comb stages at the output rate
+  for (uint8_t n = 0; n < DECIMATION_ORDER; n++) {
+    uint32_t previous = d->comb[n];
+    d->comb[n] = acc;
+    acc -= previous;
+  }
+
+  // The first DECIMATION_ORDER outputs still include the zero start-up state
+  if (++d->outputs > DECIMATION_ORDER) {
+    d->outputSum += (int32_t)acc;
+  }
+}
+
+float Decimator_Mean(const Decimator *d)
+{
+  // Mean of the settled decimated outputs, or of the raw samples if the
+  // window was too short to produce any
+  if (d->outputs > DECIMATION_ORDER) {
+    double gain = 1;
+    for (uint8_t n = 0; n < DECIMATION_ORDER; n++) {
+      gain *= DECIMATION_FACTOR;
+    }
+    return d->outputSum / (gain * (d->outputs - DECIMATION_ORDER));
+  }
+  return (d->rawCount > 0) ? (double)d->rawSum / d->rawCount : 0;
+}
+
+void Config_Poll()
+{
+  // env.modified is a single small transaction; only fetch and parse the
+  // variables when their modification time has moved
+  J *rsp = Notecard_Transaction(notecard.newRequest("env.modified"));
+  if (rsp == NULL) {
+    return;
+  }
+  JINTEGER modified = JGetInt(rsp, "time");
+  NoteDeleteResponse(rsp);
+  if (modified == configModified) {
+    return;
+  }
+
+  rsp = Notecard_Transaction(notecard.newRequest("env.get"));
+  if (rsp == NULL || notecard.responseError(rsp)) {
+    if (rsp != NULL) {
+      NoteDeleteResponse(rsp);
+    }
+    return;
+  }
+  J *body = JGetObject(rsp, "body");
+  uint8_t previousPortMask = config.muxPortMask;
+  config.intervalMs = Config_Value(body, "sample_interval_s", config.intervalMs / 1000, 60, 86400, false) * 1000;
+  config.numReadings = Config_Value(body, "sample_count", config.numReadings, 1, 60, false);
+  config.spacingMs = Config_Value(body, "sample_spacing_ms", config.spacingMs, 100, 10000, false);
+  config.gpsTimeoutS = Config_Value(body, "gps_timeout_s", config.gpsTimeoutS, 0, 3600, false);
+  config.muxPortMask = Config_Value(body, "mux_ports", config.muxPortMask, 1, 0xFF, true);
+  config.maxSilenceS = Config_Value(body, "max_silence_s", config.maxSilenceS, 0, 86400, false);
+  for (uint8_t c = 0; c < CHANNEL_COUNT; c++) {
+    char name[32];
+    snprintf(name, sizeof(name), "deadband_%s", channelNames[c]);
+    config.deadband[c] = Config_Value(body, name, config.deadband[c], 0, UINT16_MAX, false);
+  }
+  configModified = modified;
+  NoteDeleteResponse(rsp);
+
+  debugPrint("Config interval ms: "); debugPrintln(config.intervalMs);
+  debugPrint("Config readings: "); debugPrintln(config.numReadings);
+  debugPrint("Config spacing ms: "); debugPrintln(config.spacingMs);
+  debugPrint("Config GPS timeout s: "); debugPrintln(config.gpsTimeoutS);
+  debugPrint("Config mux ports: "); debugPrintln(config.muxPortMask);
+
+  // Sensors may have moved to or from a newly enabled port. The PM2.5
+  // sensors are woken so they answer the probe, and a mask that would
+  // leave a sensor type with no instance is refused.
+  if (config.muxPortMask != previousPortMask) {
+    bool pmWasAsleep = (pmWakeMs == 0);
+    PM25AQI_Wake();
+    Acquire_For(BOOT_SETTLE_MS);
+    Sensors_Discover();
+    if (ahtCount == 0 || aqiCount == 0 || ina260Count == 0) {
+      debugPrintln("mux_ports leaves a sensor type out, keeping the previous ports");
+      config.muxPortMask = previousPortMask;
+      Sensors_Discover();
+    }
+    if (pmWasAsleep) {
+      PM25AQI_Sleep();
+    }
+  }
+}
+
+unsigned long Config_Value(J *body, const char *name, unsigned long value, unsigned long minValue,
+                           unsigned long maxValue, bool hex)
+{
+  // Environment variables are strings of decimal digits, or "0x" and hex
+  // digits where hex is allowed. Unset, malformed or out-of-range values
+  // leave the current setting in place.
+  char *text = JGetString(body, name);
+  if (text == NULL || text[0] == '\0') {
+    return value;
+  }
+  int base = (hex && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) ? 16 : 10;
+  char *end = NULL;
+  unsigned long parsed = strtoul(text, &end, base);
+  if (text[0] < '0' || text[0] > '9' || *end != '\0') {
+    debugPrint("Ignoring malformed setting "); debugPrintln(name);
+    return value;
+  }
+  if (parsed < minValue || parsed > maxValue) {
+    debugPrint("Ignoring out-of-range setting "); debugPrintln(name);
+    return value;
+  }
+  return parsed;
+}
+
+void Command_Poll()
+{
+  // Drain commands.qi, deleting each note as it is read
+  for (uint8_t i = 0; i < 4; i++) {
+    J *req = notecard.newRequest("note.get");
+    if (req == NULL) {
+      return;
+    }
+    JAddStringToObject(req, "file", "commands.qi");
+    JAddBoolToObject(req, "delete", true);
+    J *rsp = Notecard_Transaction(req);
+    if (rsp == NULL) {
+      return;
+    }
+    if (notecard.responseError(rsp)) {  // {note-noexist} once the queue is empty
+      NoteDeleteResponse(rsp);
+      return;
+    }
+    Command_Apply(JGetObject(rsp, "body"));
+    NoteDeleteResponse(rsp);
+  }
+}
+
+void Command_Apply(J *body)
+{
+  // {"cmd":"burst","minutes":N,"cadence_s":M} samples every M seconds for N
+  // minutes; {"cmd":"normal"} ends a burst early. Every command is answered
+  // with a note in commands_ack.qo.
+  const char *cmd = JGetString(body, "cmd");
+  const char *status = "ok";
+  uint64_t nowMs = Clock_Now_Ms(NULL);
+
+  if (cmd != NULL && strcmp(cmd, "burst") == 0) {
+    unsigned long minutes = JGetInt(body, "minutes");
+    unsigned long cadenceS = JGetInt(body, "cadence_s");
+    if (minutes < 1 || minutes > 240 || cadenceS < 30 || cadenceS * 1000 > config.intervalMs) {
+      status = "rejected";
+    } else {
+      burstIntervalMs = cadenceS * 1000;
+      burstUntilMs = nowMs + minutes * 60000ULL;
+      PM25AQI_Wake();  // Keep the fans running for the whole burst
+    }
+  } else if (cmd != NULL && strcmp(cmd, "normal") == 0) {
+    burstUntilMs = 0;
+    PM25AQI_Sleep();  // The next window wakes them again after the usual warm-up
+  } else {
+    status = "unknown";
+  }
+  debugPrint("Command "); debugPrint(cmd ? cmd : "(none)"); debugPrint(": "); debugPrintln(status);
+
+  J *req = notecard.newRequest("note.add");
+  if (req != NULL) {
+    JAddStringToObject(req, "file", "commands_ack.qo");
+    JAddBoolToObject(req, "sync", true);
+    J *ack = JAddObjectToObject(req, "body");
+    if (ack) {
+      JAddStringToObject(ack, "cmd", cmd ? cmd : "");
+      JAddStringToObject(ack, "status", status);
+      if (burstUntilMs > nowMs) {
+        JAddNumberToObject(ack, "burst_until", (JINTEGER)(burstUntilMs / 1000));
+        JAddNumberToObject(ack, "cadence_s", burstIntervalMs / 1000);
+      }
+    }
+    if (!Notecard_Send(req)) {
+      debugPrintln("Failed to acknowledge command\n");
+    }
+  }
+}
+
+bool Sync_Completed(unsigned long sinceMs)
+{
+  // hub.sync.status has "sync":true while a sync runs, and "completed" is
+  // the number of seconds since the last one finished
+  J *rsp = Notecard_Transaction(notecard.newRequest("hub.sync.status"));
+  if (rsp == NULL) {
+    return false;
+  }
+  bool completed = !notecard.responseError(rsp) && !JGetBool(rsp, "sync") && JIsPresent(rsp, "completed") &&
+                   (unsigned long)JGetInt(rsp, "completed") * 1000 <= millis() - sinceMs;
+  NoteDeleteResponse(rsp);
+  return completed;
+}
+
+unsigned long Sample_Interval_Ms(uint64_t nowMs)
+{
+  // Burst cadence while a burst is running, the configured interval otherwise
+  return (nowMs < burstUntilMs) ? burstIntervalMs : config.intervalMs;
+}
+
+#if MULTI_RATE
+void Scheduler_Start(uint32_t nowS)
+{
+  // Put every task on the wheel at its next epoch-aligned deadline
+  for (uint8_t s = 0; s < WHEEL_SLOTS; s++) {
+    wheel[s] = TASK_NONE;
+  }
+  wheelCursorS = nowS;
+  for (uint8_t id = 0; id < TASK_COUNT; id++) {
+    tasks[id].dueS = (nowS / tasks[id].periodS + 1) * tasks[id].periodS;
+    Wheel_Insert(id);
+  }
+  schedulerStarted = true;
+}
+
+void Wheel_Insert(uint8_t id)
+{
+  uint8_t *link = &wheel[tasks[id].dueS % WHEEL_SLOTS];
+  tasks[id].next = *link;
+  *link = id;
+}
+
+void Wheel_Remove(uint8_t id)
+{
+  uint8_t *link = &wheel[tasks[id].dueS % WHEEL_SLOTS];
+  while (*link != id) {
+    link = &tasks[*link].next;
+  }
+  *link = tasks[id].next;
+}
+
+uint8_t Scheduler_Due(uint32_t nowS)
+{
+  // Advance the cursor a second at a time up to nowS. Of the tasks due in
+  // the slot being visited, the highest priority one is taken off the
+  // wheel; slot-mates due on a later turn are left alone.
+  while ((int32_t)(nowS - wheelCursorS) >= 0) {
+    uint8_t best = TASK_NONE;
+    for (uint8_t id = wheel[wheelCursorS % WHEEL_SLOTS]; id != TASK_NONE; id = tasks[id].next) {
+      if (tasks[id].dueS == wheelCursorS && (best == TASK_NONE || tasks[id].priority < tasks[best].priority)) {
+        best = id;
+      }
+    }
+    if (best != TASK_NONE) {
+      Wheel_Remove(best);
+      return best;
+    }
+    wheelCursorS++;
+  }
+  return TASK_NONE;
+}
+
+void Scheduler_Run(uint32_t nowS)
+{
+  // Run everything due by nowS, then reschedule each task on its own grid.
+  // Deadlines missed while the cycle was busy are skipped, not run late
+  // back to back.
+  uint8_t id;
+  while ((id = Scheduler_Due(nowS)) != TASK_NONE) {
+    Task *task = &tasks[id];
+    debugPrint("Running task: "); debugPrintln(task->name);
+    task->run(task);
+    task->dueS = (nowS / task->periodS + 1) * task->periodS;
+    Wheel_Insert(id);
+  }
+}
+
+uint32_t Scheduler_Next()
+{
+  // The first slot after the cursor holding a task due on this turn has
+  // the soonest deadline. Nothing within a turn means a long cadence, so
+  // fall back to comparing every task.
+  for (uint32_t s = wheelCursorS; s != wheelCursorS + WHEEL_SLOTS; s++) {
+    for (uint8_t id = wheel[s % WHEEL_SLOTS]; id != TASK_NONE; id = tasks[id].next) {
+      if (tasks[id].dueS == s) {
+        return s;
+      }
+    }
+  }
+  uint32_t nextS = UINT32_MAX;
+  for (uint8_t id = 0; id < TASK_COUNT; id++) {
+    if (tasks[id].dueS < nextS) {
+      nextS = tasks[id].dueS;
+    }
+  }
+  return nextS;
+}
+
+void Task_INA260(Task *task)
+{
+  // One reading per instance: current, voltage, power
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    float currentMa, voltageMv;
+    if (INA260_Read(k, &currentMa, &voltageMv)) {
+      task->sum[0][k] += currentMa;
+      task->sum[1][k] += voltageMv;
+      task->sum[2][k] += fabs(currentMa) * voltageMv / 1000.0;
+      task->count[k]++;
+    }
+  }
+}
+
+void Task_AHTX0(Task *task)
+{
+  // One reading per instance: temperature, humidity
+  for (uint8_t k = 0; k < ahtCount; k++) {
+    PROBE(PHASE_MUX, Mux_Select(ahtPorts[k]));
+    sensors_event_t humid, temp;
+    aht[k].getEvent(&humid, &temp);
+    I2C_Account(2, 9);
+    task->sum[0][k] += temp.temperature;
+    task->sum[1][k] += humid.relative_humidity;
+    task->count[k]++;
+  }
+}
+
+bool Task_Store_INA260()
+{
+  // Store the means of the task's readings since the last report and start
+  // a new window. False if the task has no readings yet.
+  return INA260_Store_Means(tasks[TASK_INA260].sum, tasks[TASK_INA260].count);
+}
+
+bool Task_Store_AHTX0()
+{
+  Task *task = &tasks[TASK_AHTX0];
+  bool stored = false;
+  for (uint8_t k = 0; k < ahtCount; k++) {
+    if (task->count[k] > 0) {
+      sample.temperature[k] = Fixed(task->sum[0][k] / task->count[k], 100, INT16_MIN, INT16_MAX);
+      sample.humidity[k] = Fixed(task->sum[1][k] / task->count[k], 100, 0, UINT16_MAX);
+      stored = true;
+    }
+  }
+  memset(task->sum, 0, sizeof(task->sum));
+  memset(task->count, 0, sizeof(task->count));
+  return stored;
+}
+#endif
+
+#if COROUTINE_READS
+void *SensorTask::promise_type::operator new(size_t size) noexcept
+{
+  // Take a free arena slot; failing returns NULL, which makes the call to
+  // the coroutine return an empty task instead of touching the heap
+  for (uint8_t i = 0; size <= COROUTINE_FRAME_BYTES && i < COROUTINE_TASKS; i++) {
+    if (!coroutineSlotUsed[i]) {
+      coroutineSlotUsed[i] = true;
+      return coroutineArena[i];
+    }
+  }
+  debugPrint("No arena slot for a coroutine frame of bytes: "); debugPrintln((unsigned long)size);
+  return NULL;
+}
+
+void SensorTask::promise_type::operator delete(void *frame) noexcept
+{
+  coroutineSlotUsed[((uint8_t *)frame - coroutineArena[0]) / COROUTINE_FRAME_BYTES] = false;
+}
+
+bool Executor_Spawn(SensorTask task)
+{
+  if (!task.handle || executorCount >= COROUTINE_TASKS) {
+    if (task.handle) {
+      task.handle.destroy();
+    }
+    debugPrintln("Executor could not start a task, its reading is missing from this record!");
+    return false;
+  }
+  executorTasks[executorCount++] = task.handle;
+  return true;
+}
+
+bool Executor_Check()
+{
+  // Create every task a cycle runs, all at once and without resuming them,
+  // to prove their frames fit the arena together
+  SensorTask tasks[] = { Read_INA260(), Read_PM25AQI(), Read_AHTX0(), Notecard_Find_Location() };
+  bool fits = true;
+  for (SensorTask &task : tasks) {
+    if (task.handle) {
+      task.handle.destroy();
+    } else {
+      fits = false;
+    }
+  }
+  return fits;
+}
+
+void Executor_Run()
+{
+  // Resume every task whose sleep has run out, then hand the time until the
+  // next one is due to Acquire_For(), so high-rate sampling and deferred
+  // debug output carry on while all tasks are waiting
+  while (executorCount > 0) {
+    for (uint8_t i = 0; i < executorCount;) {
+      SensorTask::promise_type &promise = executorTasks[i].promise();
+      if (millis() - promise.sleepStartMs >= promise.sleepMs) {
+        executorTasks[i].resume();
+        if (executorTasks[i].done()) {
+          executorTasks[i].destroy();
+          for (uint8_t j = i + 1; j < executorCount; j++) {
+            executorTasks[j - 1] = executorTasks[j];  // Keep spawn order
+          }
+          executorCount--;
+          continue;
+        }
+      }
+      i++;
+    }
+
+    unsigned long idleMs = UINT32_MAX;
+    for (uint8_t i = 0; i < executorCount; i++) {
+      SensorTask::promise_type &promise = executorTasks[i].promise();
+      unsigned long sleptMs = millis() - promise.sleepStartMs;
+      unsigned long leftMs = (sleptMs >= promise.sleepMs) ? 0 : promise.sleepMs - sleptMs;
+      if (leftMs < idleMs) {
+        idleMs = leftMs;
+      }
+    }
+    if (executorCount > 0 && idleMs > 0) {
+      Acquire_For(idleMs);
+    }
+  }
+}
+#endif
+
+#if MULTI_RATE || INTERRUPT_CAPTURE
+bool INA260_Store_Means(float (*sum)[MAX_SENSOR_INSTANCES], uint16_t *count)
+{
+  // Store current, voltage and power means from readings summed elsewhere,
+  // then clear the sums. False if there were no readings.
+  bool stored = false;
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    if (count[k] > 0) {
+      sample.current[k] = Fixed(sum[0][k] / count[k], 1, INT16_MIN, INT16_MAX);
+      sample.voltage[k] = Fixed(sum[1][k] / count[k], 1, 0, UINT16_MAX);
+      sample.power[k] = Fixed(sum[2][k] / count[k], 1, 0, UINT16_MAX);
+      stored = true;
+    }
+    sum[0][k] = sum[1][k] = sum[2][k] = 0;
+    count[k] = 0;
+  }
+  return stored;
+}
+#endif
+
+#if INTERRUPT_CAPTURE
+void INA260_Alert_ISR()
+{
+  CaptureEvent event = { micros() };
+  Ring_Push(&inaAlertRing, event);
+}
+
+void Notecard_Attn_ISR()
+{
+  CaptureEvent event = { micros() };
+  Ring_Push(&attnRing, event);
+}
+
+void Capture_Begin()
+{
+  // The PMSA003I has no data-ready output, so PM frames are still polled
+  pinMode(INA260_ALERT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(INA260_ALERT_PIN), INA260_Alert_ISR, FALLING);
+  Capture_Read_INA260();  // Release a line already held low, or no edge would ever come
+
+  pinMode(NOTECARD_ATTN_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(NOTECARD_ATTN_PIN), Notecard_Attn_ISR, RISING);
+  if (!Capture_Arm_Attn()) {
+    debugPrintln("Failed to arm the Notecard ATTN pin\n");
+  }
+}
+
+bool Capture_Arm_Attn()
+{
+  // ATTN goes high when a note lands in commands.qi, and has to be armed
+  // again after every time it fires
+  J *req = notecard.newRequest("card.attn");
+  if (req == NULL) {
+    return false;
+  }
+  JAddStringToObject(req, "mode", "arm,files");
+  J *files = JAddArrayToObject(req, "files");
+  JAddItemToArray(files, JCreateString("commands.qi"));
+  return Notecard_Send(req);
+}
+
+void Capture_Drain()
+{
+  // Take queued events a batch at a time. The INA260 registers only hold
+  // the latest conversion, so a single read serves a whole batch of alerts.
+  // The line is also read directly; if it is still held low, an alert was
+  // dropped or is in flight, and a read releases it.
+  CaptureEvent events[CAPTURE_BATCH];
+  uint8_t count;
+  bool alerted = false;
+  while ((count = Ring_Pop(&inaAlertRing, events, CAPTURE_BATCH)) > 0) {
+    for (uint8_t i = 0; i < count; i++) {
+      unsigned long latencyUs = micros() - events[i].us;
+      if (latencyUs > captureMaxLatencyUs) {
+        captureMaxLatencyUs = latencyUs;
+      }
+    }
+    captureEvents += count;
+    alerted = true;
+  }
+  if (alerted || digitalRead(INA260_ALERT_PIN) == LOW) {
+    Capture_Read_INA260();
+  }
+
+  if (Ring_Pop(&attnRing, events, CAPTURE_BATCH) > 0) {
+    attnPending = true;
+  }
+}
+
+void Capture_Read_INA260()
+{
+  // Reading Mask/Enable clears an INA260's alert. Another INA260 finishing
+  // meanwhile keeps the shared line low without a new edge, so go round
+  // again until the line is released.
+  uint8_t returnPort = muxPort;
+  for (uint8_t pass = 0; pass <= ina260Count; pass++) {
+    for (uint8_t k = 0; k < ina260Count; k++) {
+      PROBE(PHASE_MUX, Mux_Select(ina260Ports[k]));
+      I2C_Account(1, 3);  // Mask/Enable pointer write and 2-byte read, one repeated-start transaction
+      float currentMa, voltageMv;
+      if (ina260[k].conversionReady() && INA260_Read(k, &currentMa, &voltageMv)) {
+        captureSum[0][k] += currentMa;
+        captureSum[1][k] += voltageMv;
+        captureSum[2][k] += fabs(currentMa) * voltageMv / 1000.0;
+        captureCount[k]++;
+        captureReads++;
+      }
+    }
+    if (digitalRead(INA260_ALERT_PIN) == HIGH) {
+      break;
+    }
+  }
+  Mux_Select(returnPort);
+}
+
+bool Capture_Store_INA260()
+{
+  Capture_Drain();  // Include the conversions still queued
+  return INA260_Store_Means(captureSum, captureCount);
+}
+#endif
+
+void Sensors_Discover()
+{
+  // Scan every mux port for each supported sensor and start up to
+  // MAX_SENSOR_INSTANCES of each type, in port order
+  ahtCount = 0;
+  aqiCount = 0;
+  ina260Count = 0;
+  for (uint8_t port = 0; port < MUX_PORTS; port++) {
+    if (!(config.muxPortMask & (1 << port))) {
+      continue;  // Port disabled through the mux_ports environment variable
+    }
+    myMux.setPort(port);
+    muxPort = port;
+    I2C_Account(1, 1);
+    Wire.setClock(I2C_STANDARD_HZ);  // Probe slowly until we know what is on the port
+    i2cClockHz = I2C_STANDARD_HZ;
+    portClockHz[port] = I2C_FAST_HZ;
+
+    if (ina260Count < MAX_SENSOR_INSTANCES && I2C_Probe(INA260_I2C_ADDR) && ina260[ina260Count].begin()) {
+#if INTERRUPT_CAPTURE
+      // One 64 x (8.244 ms + 8.244 ms) conversion about every second, each
+      // signalled on the shared ALERT line
+      ina260[ina260Count].setCurrentConversionTime(INA260_TIME_8_244_ms);
+      ina260[ina260Count].setVoltageConversionTime(INA260_TIME_8_244_ms);
+      ina260[ina260Count].setAveragingCount(INA260_COUNT_64);
+      ina260[ina260Count].setAlertType(INA260_ALERT_CONVERSION_READY);
+      ina260[ina260Count].setAlertLatch(INA260_ALERT_LATCH_ENABLED);
+#elif HIGH_RATE_ACQUISITION
+      ina260[ina260Count].setAveragingCount(INA260_COUNT_1);  // Averaging is done by the decimators
+#else
+      ina260[ina260Count].setAveragingCount(INA260_COUNT_16);  // Average over 16 samples
+#endif
+      ina260Ports[ina260Count++] = port;
+      debugPrint("INA260 found on port "); debugPrintln(port);
+    }
+    if (ahtCount < MAX_SENSOR_INSTANCES && I2C_Probe(AHTX0_I2C_ADDR) && aht[ahtCount].begin()) {
+      ahtPorts[ahtCount++] = port;
+      debugPrint("AHTX0 found on port "); debugPrintln(port);
+    }
+    if (aqiCount < MAX_SENSOR_INSTANCES && I2C_Probe(PM25AQI_I2C_ADDR) && aqi[aqiCount].begin_I2C()) {
+      aqiPorts[aqiCount++] = port;
+      portClockHz[port] = I2C_STANDARD_HZ;  // PMSA003I is limited to standard mode
+      debugPrint("PM25 found on port "); debugPrintln(port);
+    }
+  }
+}
+
+bool I2C_Probe(uint8_t addr)
+{
+  // An address-only write is ACKed if a device is listening at addr
+  Wire.beginTransmission(addr);
+  I2C_Account(1, 0);
+  return Wire.endTransmission() == 0;
+}
+
+void Mux_Select(uint8_t port)
+{
+  // Switch mux ports, then set the bus clock for the devices on the new port.
+  // Switching first keeps a PMSA003I off the bus while it runs at 400 kHz.
+  // The mux holds its port, so selecting the current one again is free.
+  if (port != muxPort) {
+    myMux.setPort(port);
+    muxPort = port;
+    I2C_Account(1, 1);
+  }
+  unsigned long clockHz = portClockHz[port];
+  if (clockHz != i2cClockHz) {
+    Wire.setClock(clockHz);
+    i2cClockHz = clockHz;
+  }
+}
+
+bool I2C_Read_Registers(uint8_t addr, uint8_t reg, uint8_t *buf, uint8_t len)
+{
+  // Set the register pointer and read len bytes back in one combined
+  // transaction (repeated start, no stop in between)
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0) {
+    return false;
+  }
+  if (Wire.requestFrom(addr, len) != len) {
+    return false;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    buf[i] = Wire.read();
+  }
+  I2C_Account(1, 1 + len);
+  return true;
+}
+
+void I2C_Account(uint8_t transactions, uint16_t bytes)
+{
+  // Each transaction also sends an address byte (twice with a repeated
+  // start, which we ignore); every byte is 9 clocks including the ACK
+  i2cTransactions += transactions;
+  i2cBytes += bytes;
+  i2cBusUs += (unsigned long)(bytes + transactions) * 9 * 1000000UL / i2cClockHz;
+}
+
+void PM25AQI_Wake()
+{
+  // Drive SET high to start the fan and laser; no-op if already running
+  if (pmWakeMs != 0) {
+    return;
+  }
+  digitalWrite(PM25AQI_SET_PIN, HIGH);
+  pmWakeMs = millis();
+  if (pmWakeMs == 0) {
+    pmWakeMs = 1;  // 0 is reserved for "asleep"
+  }
+}
+
+void PM25AQI_Sleep()
+{
+  // Drive SET low to stop the fan and laser, and account for the time it ran
+  digitalWrite(PM25AQI_SET_PIN, LOW);
+  if (pmWakeMs != 0) {
+    pmFanOnMs += millis() - pmWakeMs;
+    pmWakeMs = 0;
+  }
+}
+
+void Report_Cycle(unsigned long awakeMs, unsigned long transactions, unsigned long bytesSent,
+                  unsigned long bytesReceived, bool missed)
+{
+  // One tab-separated row per cycle so runs of different firmware revisions
+  // can be pasted side by side and compared
+  cycleCount++;
+  if (missed) {
+    missedDeadlines++;
+  }
+  if (cycleCount == 1) {
+    debugPrintln("cycle\tawake_ms\tnc_txn\ttx_bytes\trx_bytes\ti2c_txn\ti2c_bytes\ti2c_us\tskipped\tmissed");
+  }
+  debugPrint(cycleCount); debugPrint("\t");
+  debugPrint(awakeMs); debugPrint("\t");
+  debugPrint(transactions); debugPrint("\t");
+  debugPrint(bytesSent); debugPrint("\t");
+  debugPrint(bytesReceived); debugPrint("\t");
+  debugPrint(i2cTransactions); debugPrint("\t");
+  debugPrint(i2cBytes); debugPrint("\t");
+  debugPrint(i2cBusUs); debugPrint("\t");
+  debugPrint(notesSkipped); debugPrint("\t");
+  debugPrintln(missedDeadlines);
+
+  i2cTransactions = 0;
+  i2cBytes = 0;
+  i2cBusUs = 0;
+
+#if INTERRUPT_CAPTURE
+  debugPrint("INA260 alerts: "); debugPrintln(captureEvents);
+  debugPrint("INA260 conversions read: "); debugPrintln(captureReads);
+  debugPrint("INA260 alerts dropped since boot: "); debugPrintln(__atomic_load_n(&inaAlertRing.dropped, __ATOMIC_RELAXED));
+  debugPrint("Longest alert latency (us): "); debugPrintln(captureMaxLatencyUs);
+  captureEvents = 0;
+  captureReads = 0;
+  captureMaxLatencyUs = 0;
+#endif
+}
+
+void Set_Time_Location(J *rsp)
+{
+  // Parse and set the time and location from the Notecard response
+  sample.time = JGetNumber(rsp, "time");
+  sample.lon = Fixed(JGetNumber(rsp, "lon"), 1e5, -18000000L, 18000000L);
+  sample.lat = Fixed(JGetNumber(rsp, "lat"), 1e5, -9000000L, 9000000L);
+}
+
+void Store_Push(const SampleRecord *rec)
+{
+  // Scatter a record into the ring, overwriting the oldest once full
+  uint8_t i = sampleStore.head;
+  sampleStore.time[i] = rec->time;
+  sampleStore.lat[i] = rec->lat;
+  sampleStore.lon[i] = rec->lon;
+  memcpy(sampleStore.temperature[i], rec->temperature, sizeof(rec->temperature));
+  memcpy(sampleStore.humidity[i], rec->humidity, sizeof(rec->humidity));
+  memcpy(sampleStore.current[i], rec->current, sizeof(rec->current));
+  memcpy(sampleStore.voltage[i], rec->voltage, sizeof(rec->voltage));
+  memcpy(sampleStore.power[i], rec->power, sizeof(rec->power));
+  memcpy(sampleStore.pm[i], rec->pm, sizeof(rec->pm));
+
+  sampleStore.head = (i + 1) % SAMPLE_STORE_RECORDS;
+  if (sampleStore.count < SAMPLE_STORE_RECORDS) {
+    sampleStore.count++;
+  }
+}
+
+bool Store_Get(uint8_t age, SampleRecord *rec)
+{
+  // Gather a record back out of the ring; age 0 is the newest
+  if (age >= sampleStore.count) {
+    return false;
+  }
+  uint8_t i = (sampleStore.head + SAMPLE_STORE_RECORDS - 1 - age) % SAMPLE_STORE_RECORDS;
+  rec->time = sampleStore.time[i];
+  rec->lat = sampleStore.lat[i];
+  rec->lon = sampleStore.lon[i];
+  memcpy(rec->temperature, sampleStore.temperature[i], sizeof(rec->temperature));
+  memcpy(rec->humidity, sampleStore.humidity[i], sizeof(rec->humidity));
+  memcpy(rec->current, sampleStore.current[i], sizeof(rec->current));
+  memcpy(rec->voltage, sampleStore.voltage[i], sizeof(rec->voltage));
+  memcpy(rec->power, sampleStore.power[i], sizeof(rec->power));
+  memcpy(rec->pm, sampleStore.pm[i], sizeof(rec->pm));
+  return true;
+}
+
+float PM_Humidity_Correct(float pm, float rh)
+{
+  // Divide out the humidity growth, interpolating linearly between table
+  // entries; a compare, a multiply-add and a multiply per value
+  if (rh <= 0) {
+    return pm;
+  }
+  if (rh >= PM_HUMIDITY_MAX_RH) {
+    rh = PM_HUMIDITY_MAX_RH - 0.001;
+  }
+  float position = rh / PM_HUMIDITY_STEP;
+  uint8_t i = (uint8_t)position;
+  float fraction = position - i;
+  return pm * (pmHumidityTable[i] + (pmHumidityTable[i + 1] - pmHumidityTable[i]) * fraction);
+}
+
+long Fixed(float value, float scale, long minValue, long maxValue)
+{
+  // Scale and round a reading into an integer field, clamping to its range
+  float scaled = round(value * scale);
+  if (scaled < minValue) {
+    return minValue;
+  }
+  if (scaled > maxValue) {
+    return maxValue;
+  }
+  return (long)scaled;
+}
+
+bool Clock_Sync()
+{
+  // card.time only has one-second resolution, so poll it until the second
+  // rolls over and timestamp that edge against millis()
+  unsigned long firstEpoch = 0;
+  for (int poll = 0; poll < 30; poll++) {
+    unsigned long requestMs = millis();
+    J *rsp = Notecard_Transaction(notecard.newRequest("card.time"));
+    if (rsp == NULL) {
+      return false;
+    }
+    unsigned long epoch = JGetInt(rsp, "time");  // Get the Notecard's current timestamp (UTC)
+    NoteDeleteResponse(rsp);
+    if (epoch == 0) {
+      return false;  // Notecard has not acquired the time yet
+    }
+
+    if (firstEpoch == 0) {
+      firstEpoch = epoch;
+    } else if (epoch != firstEpoch) {
+      // Estimate drift over the longest baseline we have; short baselines are
+      // dominated by the sync error and would make the estimate worse
+      if (clockSynced) {
+        unsigned long baselineMs = (epoch - clockAnchorEpoch) * 1000;
+        if (baselineMs >= (unsigned long)CLOCK_MIN_BASELINE_S * 1000) {
+          long offsetMs = (long)((requestMs - clockAnchorMs) - baselineMs);  // Local minus true elapsed
+          clockDriftPpm = (float)offsetMs * 1e6 / baselineMs;
+          clockDriftErrorPpm = 2.0 * CLOCK_SYNC_ERROR_MS * 1e6 / baselineMs + CLOCK_WANDER_PPM;
+        }
+        // Move the anchor forward before the baseline approaches the millis() rollover
+        if (epoch - clockAnchorEpoch > 30UL * 86400) {
+          clockAnchorEpoch = epoch;
+          clockAnchorMs = requestMs;
+        }
+      } else {
+        clockAnchorEpoch = epoch;
+        clockAnchorMs = requestMs;
+      }
+
+      clockSyncEpoch = epoch;
+      clockSyncMs = requestMs;
+      clockSynced = true;
+      hubSyncPending = false;  // The Notecard has the time, so a forced hub.sync is no longer needed
+
+      debugPrint("Clock synced, drift (ppm): "); debugPrintln(clockDriftPpm);
+      return true;
+    }
+    delay(50);
+  }
+  return false;
+}
+
+uint64_t Clock_Now_Ms(unsigned long *errorMs)
+{
+  // Wall-clock time in UTC milliseconds, corrected for the estimated drift,
+  // along with a bound on how far off it can be
+  unsigned long elapsedMs = millis() - clockSyncMs;
+  long correctionMs = (long)(elapsedMs * clockDriftPpm / 1e6);
+  if (errorMs != NULL) {
+    *errorMs = CLOCK_SYNC_ERROR_MS + (unsigned long)(elapsedMs * clockDriftErrorPpm / 1e6);
+  }
+  return (uint64_t)clockSyncEpoch * 1000 + elapsedMs - correctionMs;
+}
+
+void Send_Data()
+{
+  // Catch up first on records the Notecard could not take while it was
+  // unhealthy, oldest first and as keyframes, so notes stay in order
+  if (notesUnsent > sampleStore.count - 1) {
+    notesUnsent = sampleStore.count - 1;  // The oldest have been overwritten
+  }
+  while (notesUnsent > 0) {
+    SampleRecord old;
+    if (!Store_Get(notesUnsent, &old) || !Send_Record(&old, true)) {
+      break;
+    }
+    notesUnsent--;
+  }
+
+  // Serialize the newest record in the sample store
+  SampleRecord rec;
+  if (!Store_Get(0, &rec)) {
+    return;
+  }
+  if (notesUnsent > 0) {
+    notesUnsent++;  // Still behind; queue this one too rather than jump ahead
+    return;
+  }
+  if (!Report_Due(&rec)) {
+    notesSkipped++;
+    debugPrintln("Every channel is inside its deadband, skipping note");
+    return;
+  }
+
+  // A keyframe carries every field. In sparse mode the notes in between only
+  // carry what differs from the last note the Notecard accepted, and "seq"
+  // lets the receiver spot a lost note and wait for the next keyframe.
+  bool key = true;
+#if SPARSE_PAYLOADS
+  key = !reportedValid || noteSeq % SPARSE_KEYFRAME_NOTES == 0;
+#endif
+
+  if (!Send_Record(&rec, key)) {
+    notesUnsent = 1;
+  }
+}
+
+bool Send_Record(const SampleRecord *rec, bool key)
+{
+  J *req = Data_Note(rec, key);
+  if (req == NULL) {
+    return false;
+  }
+  if (!Notecard_Send(req)) {  // Send the request to the Notecard
+    debugPrintln("Failed to add data note\n");
+    return false;
+  }
+  reported = *rec;
+  reportedValid = true;
+  noteSeq++;
+  syncStartMs = millis() | 1;  // Check for inbound changes once the sync has run
+  syncCheckMs = millis();
+  return true;
+}
+
+J *Data_Note(const SampleRecord *rec, bool key)
+{
+#if !EPOCH_TIME
+  // Split the timestamps into the date/time strings the dashboard expects
+  TimeFields t, rt;
+  Time_Format(rec->time, &t);
+  Time_Format(reported.time, &rt);
+  bool dateChanged = key || strcmp(t.yyyy, rt.yyyy) != 0 || strcmp(t.mM, rt.mM) != 0 || strcmp(t.dd, rt.dd) != 0;
+#endif
+
+  // Create a Notecard request to send sensor data
+  J *req = notecard.newRequest("note.add");  
+  if (req != NULL)
+  {
+    JAddStringToObject(req, "file", "data.qo");  // Store data in "sensors.qo" file
+    JAddBoolToObject(req, "sync", true);  // Request immediate sync
+    J *body = JAddObjectToObject(req, "body");
+    if (body)
+    {
+#if SPARSE_PAYLOADS
+      JAddNumberToObject(body, "seq", noteSeq);
+      if (key) {
+        JAddBoolToObject(body, "key", true);
+      }
+#endif
+
+      // Add time and location data
+#if EPOCH_TIME
+      JAddNumberToObject(body, "time", rec->time);  // UTC seconds
+#else
+      if (dateChanged) {
+        JAddStringToObject(body, "YYYY", t.yyyy);
+        JAddStringToObject(body, "MM", t.mM);
+        JAddStringToObject(body, "DD", t.dd);  
+      }
+      if (dateChanged || strcmp(t.hh, rt.hh) != 0) {
+        JAddStringToObject(body, "hh", t.hh);
+      }
+      JAddStringToObject(body, "mm", t.mm);
+      JAddStringToObject(body, "ss", t.ss);
+#endif
+      if (key || rec->lat != reported.lat || rec->lon != reported.lon) {
+        JAddNumberToObject(body, "lat", rec->lat / 1e5);
+        JAddNumberToObject(body, "lon", rec->lon / 1e5);
+      }
+
+      // Add sensor data for temperature and humidity
+      if (key || rec->temperature[0] != reported.temperature[0]) {
+        JAddNumberToObject(body, "temperature", rec->temperature[0] / 100.0);  // Temperature
+      }
+      if (key || rec->humidity[0] != reported.humidity[0]) {
+        JAddNumberToObject(body, "humidity", rec->humidity[0] / 100.0);  // Humidity
+      }
+
+      // Add PM2.5 AQI sensor data and particle counts for various sizes
+      for (uint8_t f = 0; f < PM_FIELDS; f++) {
+        if (key || rec->pm[0][f] != reported.pm[0][f]) {
+          JAddNumberToObject(body, pmFieldNames[f], rec->pm[0][f] / pmFieldScale[f]);
+        }
+      }
+
+      // Add the humidity-corrected mass readings alongside the raw ones
+      float rh = rec->humidity[0] / 100.0;
+      bool rhChanged = key || rec->humidity[0] != reported.humidity[0];
+      if (rhChanged || rec->pm[0][4] != reported.pm[0][4]) {
+        JAddNumberToObject(body, "pm25_env_rh", round(PM_Humidity_Correct(rec->pm[0][4] / pmFieldScale[4], rh) * 10) / 10);
+      }
+      if (rhChanged || rec->pm[0][5] != reported.pm[0][5]) {
+        JAddNumberToObject(body, "pm100_env_rh", round(PM_Humidity_Correct(rec->pm[0][5] / pmFieldScale[5], rh) * 10) / 10);
+      }
+
+      // Add INA260 sensor data (current, voltage, power)
+      if (key || rec->current[0] != reported.current[0]) {
+        JAddNumberToObject(body, "current", rec->current[0]);  // Current
+      }
+      if (key || rec->voltage[0] != reported.voltage[0]) {
+        JAddNumberToObject(body, "voltage", rec->voltage[0]);  // Voltage
+      }
+      if (key || rec->power[0] != reported.power[0]) {
+        JAddNumberToObject(body, "power", rec->power[0]);  // Power
+      }
+
+      // Add every instance, with its mux port, when redundant sensors are fitted
+      if (ahtCount > 1) {
+        J *list = JAddArrayToObject(body, "ahtx0");
+        for (uint8_t k = 0; list && k < ahtCount; k++) {
+          J *item = JCreateObject();
+          JAddNumberToObject(item, "port", ahtPorts[k]);
+          if (key || rec->temperature[k] != reported.temperature[k]) {
+            JAddNumberToObject(item, "temperature", rec->temperature[k] / 100.0);
+          }
+          if (key || rec->humidity[k] != reported.humidity[k]) {
+            JAddNumberToObject(item, "humidity", rec->humidity[k] / 100.0);
+          }
+          JAddItemToArray(list, item);
+        }
+      }
+      if (aqiCount > 1) {
+        J *list = JAddArrayToObject(body, "pm25aqi");
+        for (uint8_t k = 0; list && k < aqiCount; k++) {
+          J *item = JCreateObject();
+          JAddNumberToObject(item, "port", aqiPorts[k]);
+          for (uint8_t f = 0; f < PM_FIELDS; f++) {
+            if (key || rec->pm[k][f] != reported.pm[k][f]) {
+              JAddNumberToObject(item, pmFieldNames[f], rec->pm[k][f] / pmFieldScale[f]);
+            }
+          }
+          if (rhChanged || rec->pm[k][4] != reported.pm[k][4]) {
+            JAddNumberToObject(item, "pm25_env_rh", round(PM_Humidity_Correct(rec->pm[k][4] / pmFieldScale[4], rh) * 10) / 10);
+          }
+          if (rhChanged || rec->pm[k][5] != reported.pm[k][5]) {
+            JAddNumberToObject(item, "pm100_env_rh", round(PM_Humidity_Correct(rec->pm[k][5] / pmFieldScale[5], rh) * 10) / 10);
+          }
+          JAddItemToArray(list, item);
+        }
+      }
+      if (ina260Count > 1) {
+        J *list = JAddArrayToObject(body, "ina260");
+        for (uint8_t k = 0; list && k < ina260Count; k++) {
+          J *item = JCreateObject();
+          JAddNumberToObject(item, "port", ina260Ports[k]);
+          if (key || rec->current[k] != reported.current[k]) {
+            JAddNumberToObject(item, "current", rec->current[k]);
+          }
+          if (key || rec->voltage[k] != reported.voltage[k]) {
+            JAddNumberToObject(item, "voltage", rec->voltage[k]);
+          }
+          if (key || rec->power[k] != reported.power[k]) {
+            JAddNumberToObject(item, "power", rec->power[k]);
+          }
+          JAddItemToArray(list, item);
+        }
+      }
+
+#if ENERGY_MODEL
+      // Add the energy estimate from the previous cycle
+      JAddNumberToObject(body, "mah_cycle", energyCycle_mAh * energyScale);
+      JAddNumberToObject(body, "mah_day", energyDay_mAh);
+#endif
+
 #if DEBUG
-  Serial.print(message);
+      // Running average body size, to compare sparse and full payloads
+      char *json = JPrintUnformatted(body);
+      if (json != NULL) {
+        dataBodyBytes += strlen(json);
+        dataBodies++;
+        JFree(json);
+        debugPrint("Average data note body bytes: "); debugPrintln(dataBodyBytes / dataBodies);
+      }
 #endif
+    }
+
+  }
+  return req;
 }
 
-template <typename T>
-void debugPrintln(T message) {
+void Time_Format(uint32_t time, TimeFields *out)
+{
+  // Split UTC epoch seconds into the dashboard strings with the
+  // days-to-civil conversion (Howard Hinnant's civil_from_days), shifted
+  // so years start on 1 March and leap days fall at the end. No heap,
+  // locale or C time library; localtime() on the MCU was UTC anyway.
+  uint32_t days = time / 86400;
+  uint32_t secondOfDay = time % 86400;
+  uint32_t z = days + 719468;  // Days since 0000-03-01
+  uint32_t era = z / 146097;  // 400-year eras
+  uint32_t dayOfEra = z - era * 146097;
+  uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  uint32_t shiftedMonth = (5 * dayOfYear + 2) / 153;  // 0 = March
+  uint8_t day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+  uint8_t month = (shiftedMonth < 10) ? shiftedMonth + 3 : shiftedMonth - 9;
+  uint16_t year = yearOfEra + era * 400 + (month <= 2);
+
+  Two_Digits(out->yyyy, year / 100);
+  Two_Digits(out->yyyy + 2, year % 100);
+  Two_Digits(out->mM, month);
+  Two_Digits(out->dd, day);
+  Two_Digits(out->hh, secondOfDay / 3600);
+  Two_Digits(out->mm, secondOfDay / 60 % 60);
+  Two_Digits(out->ss, secondOfDay % 60);
+}
+
+void Two_Digits(char *out, uint8_t value)
+{
+  out[0] = '0' + value / 10;
+  out[1] = '0' + value % 10;
+  out[2] = '\0';
+}
+
+#if BINARY_UPLOAD
+bool Binary_Upload(uint8_t firstAge, uint8_t count)
+{
+  // Pack count records ending at firstAge into one block, hand it to the
+  // Notecard binary buffer in as few chunks as BINARY_CHUNK_BYTES allows
+  // (one, by default), and attach it to a single burst.qo note. note-c checks
+  // every chunk as it arrives; the CRC in the header lets the receiver check
+  // the block once it has been reassembled.
+  if (count > sampleStore.count - firstAge) {
+    count = sampleStore.count - firstAge;
+  }
+  if (count == 0) {
+    return true;
+  }
+  if (count > BINARY_BLOCK_RECORDS) {
+    count = BINARY_BLOCK_RECORDS;  // Anything older is dropped rather than block the cycle
+  }
+  if (NoteBinaryCodecMaxEncodedLength(BINARY_CHUNK_BYTES) > sizeof(binaryChunk)) {
+    debugPrintln("Binary chunk buffer too small for the encoding\n");
+    return false;
+  }
+
+  BinaryBlockHeader header = { { 'A', 'Q' }, 1, count, sizeof(SampleRecord), 0, 0, 0 };
+  uint32_t blockBytes = sizeof(header);
+#if DEBUG
+  unsigned long jsonBytes = 0;  // What one keyframe data note per record would have sent
+#endif
+  for (uint8_t age = firstAge + count; age-- > firstAge;) {
+    SampleRecord *rec = (SampleRecord *)(binaryBlock + blockBytes);
+    Store_Get(age, rec);
+    if (header.firstTime == 0) {
+      header.firstTime = rec->time;
+    }
+    blockBytes += sizeof(SampleRecord);
+#if DEBUG
+    J *note = Data_Note(rec, true);
+    if (note != NULL) {
+      char *json = JPrintUnformatted(note);
+      if (json != NULL) {
+        jsonBytes += strlen(json) + 1;  // Newline-terminated on the wire
+        JFree(json);
+      }
+      JDelete(note);
+    }
+#endif
+  }
+  header.crc32 = ~Crc32(0xFFFFFFFFUL, binaryBlock + sizeof(header), blockBytes - sizeof(header));
+  memcpy(binaryBlock, &header, sizeof(header));
+
+  unsigned long startMs = millis();
+  const char *err = NoteBinaryStoreReset();
+  if (err != NULL) {
+    debugPrint("Binary reset failed: "); debugPrintln(err);
+    return false;
+  }
+  uint32_t offset = 0;
+  uint8_t chunks = 0;
+  while (offset < blockBytes) {
+    uint32_t len = blockBytes - offset;
+    if (len > BINARY_CHUNK_BYTES) {
+      len = BINARY_CHUNK_BYTES;
+    }
+    if (!Binary_Transmit(binaryBlock + offset, len, offset)) {
+      return false;
+    }
+    offset += len;
+    chunks++;
+  }
+
+  bool sent = false;
+  J *req = notecard.newRequest("note.add");
+  if (req != NULL) {
+    JAddStringToObject(req, "file", "burst.qo");
+    JAddBoolToObject(req, "binary", true);
+    JAddBoolToObject(req, "sync", true);
+    J *body = JAddObjectToObject(req, "body");
+    if (body) {
+      JAddNumberToObject(body, "records", count);
+      JAddNumberToObject(body, "first", header.firstTime);
+      JAddNumberToObject(body, "crc32", header.crc32);
+    }
+    sent = Notecard_Send(req);
+  }
+  if (!sent) {
+    debugPrintln("Failed to add binary block note\n");
+    return false;
+  }
+  syncStartMs = millis() | 1;
+  syncCheckMs = millis();
+
+  // Throughput of the binary path, to compare with one JSON note per record
+  binaryBytes += offset;
+  binaryMs += millis() - startMs;
+  debugPrint("Binary block bytes: "); debugPrintln(offset);
+  debugPrint("Binary block transactions: "); debugPrintln(chunks + 2);  // Reset, chunks, note.add
+  if (binaryMs > 0) {
+    debugPrint("Binary upload bytes/s: "); debugPrintln(binaryBytes * 1000.0 / binaryMs);
+  }
 #if DEBUG
-  Serial.println(message);
+  debugPrint("JSON notes for the same records, bytes: "); debugPrintln(jsonBytes);
+  debugPrint("JSON notes for the same records, transactions: "); debugPrintln(count);
+#endif
+  return true;
+}
+
+bool Binary_Transmit(const void *data, uint32_t len, uint32_t offset)
+{
+  // NoteBinaryStoreTransmit() encodes in place, so stage the chunk in a
+  // buffer with room for the encoding overhead
+  memcpy(binaryChunk, data, len);
+  const char *err = NoteBinaryStoreTransmit(binaryChunk, len, sizeof(binaryChunk), offset);
+  if (err != NULL) {
+    debugPrint("Binary transmit failed: "); debugPrintln(err);
+    return false;
+  }
+  return true;
+}
+#endif
+
+void Checkpoint_Save(uint8_t phase, uint32_t cycleEpoch)
+{
+  // A few hundred bytes of CRC per step, cheap next to the step itself
+  if (!checkpointRetained) {
+    return;
+  }
+  checkpoint.magic = CHECKPOINT_MAGIC;
+  checkpoint.phase = phase;
+  checkpoint.notesUnsent = notesUnsent;
+  checkpoint.cycleEpoch = cycleEpoch;
+  checkpoint.sample = sample;
+  checkpoint.crc = ~Crc32(0xFFFFFFFFUL, &checkpoint, offsetof(Checkpoint, crc));
+}
+
+bool Checkpoint_Restore()
+{
+  // True if retained RAM holds an intact checkpoint of an unfinished cycle
+  if (!checkpointRetained || checkpoint.magic != CHECKPOINT_MAGIC ||
+      checkpoint.crc != ~Crc32(0xFFFFFFFFUL, &checkpoint, offsetof(Checkpoint, crc))) {
+    return false;
+  }
+  return checkpoint.phase != CHECKPOINT_NONE;
+}
+
+bool Checkpoint_Retained()
+{
+  // The section attribute only names where the checkpoint goes; the linker
+  // script decides whether that survives a reset. Reject an address inside
+  // the zeroed .bss or at or past the start of the heap.
+#if defined(ARDUINO_ARCH_STM32)
+  const uint8_t *p = (const uint8_t *)&checkpoint;
+  return !(p + sizeof(checkpoint) > _sbss && p < _ebss) && p + sizeof(checkpoint) <= end;
+#else
+  return true;  // Other cores: check the map file for .noinit placement by hand
+#endif
+}
+
+uint32_t Crc32(uint32_t crc, const void *data, size_t len)
+{
+  // Bitwise CRC-32 (IEEE 802.3, reflected); start at 0xFFFFFFFF and invert
+  // the result. Blocks are small, so a table is not worth the flash.
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (len--) {
+    crc ^= *bytes++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return crc;
+}
+
+bool Report_Due(const SampleRecord *rec)
+{
+  // A note is due when any channel has moved past its deadband since the
+  // last note, when the silence interval has run out, and throughout a burst.
+  // With no silence interval configured every cycle reports.
+  if (!reportedValid || config.maxSilenceS == 0 || Clock_Now_Ms(NULL) < burstUntilMs ||
+      rec->time - reported.time >= config.maxSilenceS) {
+    return true;
+  }
+  for (uint8_t k = 0; k < ahtCount; k++) {
+    if (Outside_Deadband(rec->temperature[k], reported.temperature[k], CHANNEL_TEMPERATURE) ||
+        Outside_Deadband(rec->humidity[k], reported.humidity[k], CHANNEL_HUMIDITY)) {
+      return true;
+    }
+  }
+  for (uint8_t k = 0; k < aqiCount; k++) {
+    for (uint8_t f = 0; f < PM_FIELDS; f++) {
+      if (Outside_Deadband(rec->pm[k][f], reported.pm[k][f], (f < 6) ? CHANNEL_PM_MASS : CHANNEL_PM_COUNT)) {
+        return true;
+      }
+    }
+  }
+  for (uint8_t k = 0; k < ina260Count; k++) {
+    if (Outside_Deadband(rec->current[k], reported.current[k], CHANNEL_CURRENT) ||
+        Outside_Deadband(rec->voltage[k], reported.voltage[k], CHANNEL_VOLTAGE) ||
+        Outside_Deadband(rec->power[k], reported.power[k], CHANNEL_POWER)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Outside_Deadband(long value, long last, Channel channel)
+{
+  return labs(value - last) > config.deadband[channel];
+}
+
+#if PROFILE || ENERGY_MODEL
+void Phase_Record(Phase phase, unsigned long us)
+{
+  // Fan a probe measurement out to whichever consumers are compiled in
+#if PROFILE
+  Profile_Record(phase, us);
+#endif
+#if ENERGY_MODEL
+  cyclePhaseUs[phase] += us;
+#endif
+}
+#endif
+
+#if ENERGY_MODEL
+float Energy_Cycle_mAh(const unsigned long *phaseUs, unsigned long fanOnMs, unsigned long periodMs,
+                       float *modelledMa)
+{
+  // Integrate active current over the time each component was busy and idle
+  // current over the rest of the period. Pure function of its inputs so it
+  // gives the same answer on the device and in a host simulation.
+  float activeMs[COMP_COUNT];
+  activeMs[COMP_MCU] = periodMs;
+  activeMs[COMP_MODEM] = phaseUs[PHASE_SEND] / 1000.0 + MODEM_SYNC_S * 1000.0;
+  activeMs[COMP_GPS] = phaseUs[PHASE_LOCATION] / 1000.0;
+  activeMs[COMP_PM25AQI] = fanOnMs;
+  activeMs[COMP_AHTX0] = phaseUs[PHASE_AHTX0] / 1000.0;
+  activeMs[COMP_INA260] = periodMs;
+
+  float maMs = 0;
+  for (uint8_t c = 0; c < COMP_COUNT; c++) {
+    float active = (activeMs[c] < periodMs) ? activeMs[c] : periodMs;
+    maMs += componentActiveMa[c] * active + componentIdleMa[c] * (periodMs - active);
+  }
+
+  // Current the model expects while the INA260 is sampling: PM fan warming
+  // up, Notecard and GPS idle
+  if (modelledMa != NULL) {
+    *modelledMa = componentActiveMa[COMP_MCU] + componentIdleMa[COMP_MODEM] + componentIdleMa[COMP_GPS] +
+                  componentActiveMa[COMP_PM25AQI] + componentIdleMa[COMP_AHTX0] + componentActiveMa[COMP_INA260];
+  }
+  return maMs / 3.6e6;  // mA*ms to mAh
+}
+
+void Energy_Update(unsigned long periodMs)
+{
+  // Estimate this cycle's charge, correct it against the INA260 and start the next cycle
+  if (periodMs == 0) {
+    return;
+  }
+  float modelledMa = 0;
+  energyCycle_mAh = Energy_Cycle_mAh(cyclePhaseUs, pmFanOnMs - energyFanOnStartMs, periodMs, &modelledMa);
+  if (inaIntervalMean) {
+    // A captured or task mean spans the interval, fan mostly off, so compare
+    // it with the model's average current over the cycle instead
+    modelledMa = energyCycle_mAh * 3.6e6 / periodMs;
+  }
+
+  // Reconcile against the INA260 power reading (mW / V = mA)
+  if (sample.voltage[0] > 0 && modelledMa > 0) {
+    float measuredMa = sample.power[0] / (sample.voltage[0] / 1000.0);
+    energyScale += ENERGY_SCALE_WEIGHT * (measuredMa / modelledMa - energyScale);
+  }
+  energyDay_mAh = energyCycle_mAh * energyScale * (86400000.0 / periodMs);
+
+  debugPrint("Estimated mAh this cycle: "); debugPrintln(energyCycle_mAh * energyScale);
+  debugPrint("Estimated mAh per day: "); debugPrintln(energyDay_mAh);
+  debugPrint("Measured / modelled current: "); debugPrintln(energyScale);
+
+  memset(cyclePhaseUs, 0, sizeof(cyclePhaseUs));
+  energyFanOnStartMs = pmFanOnMs;
+}
+#endif
+
+#if PROFILE
+void Profile_Record(Phase phase, unsigned long us)
+{
+  // Bucket index is the position of the highest set bit, so the histogram
+  // covers 1 us to ~18 minutes in a fixed 30 counters per phase
+  uint8_t bucket = 0;
+  while ((us >> (bucket + 1)) != 0 && bucket < PROFILE_BUCKETS - 1) {
+    bucket++;
+  }
+  if (phaseHistogram[phase][bucket] < 0xFFFF) {
+    phaseHistogram[phase][bucket]++;
+  }
+  if (us > phaseMaxUs[phase]) {
+    phaseMaxUs[phase] = us;
+  }
+}
+
+unsigned long Profile_Percentile(Phase phase, uint8_t percent)
+{
+  // Upper edge of the bucket holding the requested percentile, in
+  // microseconds, capped at the phase maximum. A bucket spans a factor of
+  // two, so the true percentile lies between half this value and this value.
+  unsigned long total = 0;
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+    total += phaseHistogram[phase][b];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  unsigned long target = (total * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+    seen += phaseHistogram[phase][b];
+    if (seen >= target) {
+      unsigned long edge = (2UL << b) - 1;
+      return (edge < phaseMaxUs[phase]) ? edge : phaseMaxUs[phase];
+    }
+  }
+  return phaseMaxUs[phase];
+}
+
+void Send_Health()
+{
+  // Report p50/p90/p99/max per phase in milliseconds, then start a new period.
+  // Each phase also carries its nonzero histogram span: "lo" is the first
+  // bucket and "hist" the counts from there on, so host/decode_health can
+  // bound the percentiles itself.
+  J *req = notecard.newRequest("note.add");
+  if (req != NULL)
+  {
+    JAddStringToObject(req, "file", "health.qo");
+    J *body = JAddObjectToObject(req, "body");
+    if (body)
+    {
+      JAddNumberToObject(body, "cycles", profileCycles);
+      for (uint8_t p = 0; p < PHASE_COUNT; p++) {
+        J *phase = JAddObjectToObject(body, phaseNames[p]);
+        if (phase) {
+          JAddNumberToObject(phase, "p50", Profile_Percentile((Phase)p, 50) / 1000.0);
+          JAddNumberToObject(phase, "p90", Profile_Percentile((Phase)p, 90) / 1000.0);
+          JAddNumberToObject(phase, "p99", Profile_Percentile((Phase)p, 99) / 1000.0);
+          JAddNumberToObject(phase, "max", phaseMaxUs[p] / 1000.0);
+          int8_t lo = -1, hi = -1;
+          for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+            if (phaseHistogram[p][b] != 0) {
+              hi = b;
+              if (lo < 0) {
+                lo = b;
+              }
+            }
+          }
+          J *hist = (lo >= 0) ? JAddArrayToObject(phase, "hist") : NULL;
+          if (hist) {
+            JAddNumberToObject(phase, "lo", lo);
+            for (int8_t b = lo; b <= hi; b++) {
+              JAddItemToArray(hist, JCreateNumber(phaseHistogram[p][b]));
+            }
+          }
+        }
+      }
+      Notecard_Report_Stats(body);
+    }
+    if (!Notecard_Send(req)) {
+      debugPrintln("Failed to send health note\n");
+    }
+  }
+
+  memset(phaseHistogram, 0, sizeof(phaseHistogram));
+  memset(phaseMaxUs, 0, sizeof(phaseMaxUs));
+  memset(notecardStats, 0, sizeof(notecardStats));
+  profileCycles = 0;
+}
+#endif
+
+template <typename T>
+void Debug_Print(const T &message, bool literal, bool newline) {
+#if DEBUG && DEBUG_DEFERRED
+  if (literal) {
+    Log_Literal(message, newline);
+  } else {
+    Log_Arg(message, newline);
+  }
+#elif DEBUG
+  if (newline) {
+    Serial.println(message);
+  } else {
+    Serial.print(message);
+  }
+#endif
+}
+
+void debugFlush() {
+#if DEBUG && DEBUG_DEFERRED
+  // Send one queued entry per call so idle loops stay responsive
+  if (logDropped > 0) {
+    uint8_t record[3] = { LOG_DROPPED | LOG_NEWLINE, (uint8_t)logDropped, (uint8_t)(logDropped >> 8) };
+    Log_Send(record, sizeof(record));
+    logDropped = 0;
+  }
+  if (logTail == logHead) {
+    return;
+  }
+  LogEntry *e = &logRing[logTail];
+  uint8_t record[LOG_RECORD_BYTES];
+  size_t len = 1;
+  record[0] = e->type;
+  switch (e->type) {
+    case LOG_LITERAL: {
+      uint16_t id = Log_Format_Id(e->value.literal);
+      if (id < LOG_FORMATS) {
+        record[len++] = id & 0xFF;
+        record[len++] = id >> 8;
+      } else {
+        record[0] = LOG_TEXT;  // Out of format IDs
+        len = Log_Put_Text(record, e->value.literal);
+      }
+      break;
+    }
+    case LOG_TEXT: len = Log_Put_Text(record, e->value.text); break;
+    case LOG_LONG: memcpy(record + 1, &e->value.l, sizeof(long)); len += sizeof(long); break;
+    case LOG_ULONG: memcpy(record + 1, &e->value.ul, sizeof(unsigned long)); len += sizeof(unsigned long); break;
+    case LOG_DOUBLE: memcpy(record + 1, &e->value.d, sizeof(double)); len += sizeof(double); break;
+  }
+  if (e->newline) {
+    record[0] |= LOG_NEWLINE;
+  }
+  Log_Send(record, len);
+  logTail = (logTail + 1) % LOG_ENTRIES;
+#endif
+}
+
+void debugDrain() {
+#if DEBUG && DEBUG_DEFERRED
+  // Send everything queued, for reports longer than the ring
+  do {
+    debugFlush();
+  } while (logTail != logHead);
 #endif
 }
 
+#if DEBUG && DEBUG_DEFERRED
+uint16_t Log_Format_Id(const char *literal)
+{
+  // Format ID of a literal, defining it with a LOG_FORMAT record the first
+  // time; LOG_FORMATS once every ID is taken. Only runs from debugFlush(),
+  // so the search stays off the logging path.
+  for (uint16_t id = 0; id < logFormatCount; id++) {
+    if (logFormats[id] == literal) {
+      return id;
+    }
+  }
+  if (logFormatCount == LOG_FORMATS) {
+    return LOG_FORMATS;
+  }
+  uint16_t id = logFormatCount++;
+  logFormats[id] = literal;
+  uint8_t record[LOG_RECORD_BYTES];
+  record[0] = LOG_FORMAT;
+  record[1] = id & 0xFF;
+  record[2] = id >> 8;
+  size_t len = 3 + strnlen(literal, sizeof(record) - 3);
+  memcpy(record + 3, literal, len - 3);
+  Log_Send(record, len);
+  return id;
+}
+
+size_t Log_Put_Text(uint8_t *record, const char *text)
+{
+  // Text after the type byte, cut to fit; returns the record length
+  size_t len = strnlen(text, LOG_RECORD_BYTES - 1);
+  memcpy(record + 1, text, len);
+  return 1 + len;
+}
+
+void Log_Send(const uint8_t *record, size_t len)
+{
+  // COBS: every zero byte is replaced by the distance to the next one, so
+  // the only zero on the wire is the one that ends the frame. Records are
+  // shorter than 254 bytes, which keeps it to a single block.
+  static_assert(LOG_RECORD_BYTES < 254, "Deferred log records need a multi-block COBS encoder");
+  uint8_t frame[LOG_RECORD_BYTES + 2];
+  size_t codeAt = 0;
+  size_t out = 1;
+  for (size_t i = 0; i < len; i++) {
+    if (record[i] == 0) {
+      frame[codeAt] = out - codeAt;
+      codeAt = out++;
+    } else {
+      frame[out++] = record[i];
+    }
+  }
+  frame[codeAt] = out - codeAt;
+  frame[out++] = 0;
+  Serial.write(frame, out);
+}
+
+LogEntry *Log_Claim(uint8_t type, bool newline)
+{
+  // Next free entry, or NULL (and counted) when the ring is full
+  uint8_t next = (logHead + 1) % LOG_ENTRIES;
+  if (next == logTail) {
+    logDropped++;
+    return NULL;
+  }
+  LogEntry *e = &logRing[logHead];
+  e->type = type;
+  e->newline = newline;
+  logHead = next;
+  return e;
+}
+
+template <typename T>
+void Log_Literal(const T &message, bool newline) {
+  Log_Arg(message, newline);  // Only string literals are flagged, so never reached
+}
+
+template <size_t N>
+void Log_Literal(const char (&message)[N], bool newline) {
+  LogEntry *e = Log_Claim(LOG_LITERAL, newline);
+  if (e) {
+    e->value.literal = message;
+  }
+}
+
+void Log_Arg(const char *message, bool newline) {
+  LogEntry *e = Log_Claim(LOG_TEXT, newline);
+  if (e) {
+    strncpy(e->value.text, message ? message : "", LOG_TEXT_BYTES - 1);
+    e->value.text[LOG_TEXT_BYTES - 1] = '\0';
+  }
+}
+
+void Log_Arg(int value, bool newline) {
+  Log_Arg((long)value, newline);
+}
+
+void Log_Arg(unsigned int value, bool newline) {
+  Log_Arg((unsigned long)value, newline);
+}
+
+void Log_Arg(long value, bool newline) {
+  LogEntry *e = Log_Claim(LOG_LONG, newline);
+  if (e) {
+    e->value.l = value;
+  }
+}
+
+void Log_Arg(unsigned long value, bool newline) {
+  LogEntry *e = Log_Claim(LOG_ULONG, newline);
+  if (e) {
+    e->value.ul = value;
+  }
+}
+
+void Log_Arg(double value, bool newline) {
+  LogEntry *e = Log_Claim(LOG_DOUBLE, newline);
+  if (e) {
+    e->value.d = value;
+  }
+}
+#endif
+
@@ -0,0 +1,51 @@
+// Single-producer, single-consumer ring between an interrupt handler and
+// loop(). Each index is written by one side only and published with
+// release/acquire ordering, so neither side has to mask interrupts. One
+// slot stays empty to tell a full ring from an empty one.
+//
+// Kept apart from mux_final_program.cpp so the host build can stress it
+// with two threads (host/test_spsc_ring.cpp).
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+
+template <typename T, uint8_t N>
+struct SpscRing {
+  T items[N];
+  uint8_t head;  // Next slot to fill, written by the producer only
+  uint8_t tail;  // Next slot to take, written by the consumer only
+  uint16_t dropped;  // Pushes refused because the ring was full, since boot
+};
+
+template <typename T, uint8_t N>
+bool Ring_Push(SpscRing<T, N> *ring, const T &item)
+{
+  // Producer side, safe to call from an interrupt handler
+  uint8_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint8_t next = (head + 1) % N;
+  if (next == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+    ring->dropped++;
+    return false;
+  }
+  ring->items[head] = item;
+  __atomic_store_n(&ring->head, next, __ATOMIC_RELEASE);  // Publish the item
+  return true;
+}
+
+template <typename T, uint8_t N>
+uint8_t Ring_Pop(SpscRing<T, N> *ring, T *items, uint8_t maxItems)
+{
+  // Consumer side: copy out up to maxItems and free their slots together
+  uint8_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint8_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint8_t count = 0;
+  while (tail != head && count < maxItems) {
+    items[count++] = ring->items[tail];
+    tail = (tail + 1) % N;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  return count;
+}
+
+#endif